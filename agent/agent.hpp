@@ -15,12 +15,22 @@
 /* JSON parser */
 #include <nlohmann/json.hpp>
 
+/* Wire Protocol */
+#include "core/protocol.h"
+
+/* Compression Config */
+#include "core/deflate.h"
+
 /* FMT */
 #include <spdlog/fmt/fmt.h>
 #include <spdlog/fmt/bundled/format.h>
 
 /* Server type shortcut */
+#ifdef ENABLE_PERMESSAGE_DEFLATE
+typedef websocketpp::client<Horus::Deflate::Config> client_t;
+#else
 typedef websocketpp::client<websocketpp::config::asio> client_t;
+#endif
 typedef websocketpp::connection_hdl con_hdl_t;
 
 class Agent
@@ -30,7 +40,7 @@ public:
     ~Agent();
 
     /* Agent Loop */
-    void run(std::string host = "127.0.0.1", uint16_t port = 9002, std::string name = "agent");
+    void run(std::string host = "127.0.0.1", uint16_t port = 9002, std::string name = "agent", Horus::Protocol::Encoding encoding = Horus::Protocol::Encoding::json);
     void stop();
 
     /* Connection Open Handler */
@@ -42,14 +52,24 @@ public:
     /* Message Handler */
     void on_message(con_hdl_t handle, client_t::message_ptr message);
 
+    /* Typed Message Dispatch */
+    template <typename Message>
+    void dispatch(con_hdl_t handle, const nlohmann::json &payload, void (Agent::*handler)(con_hdl_t, const Message &));
+
+    /* Send a payload with the negotiated encoding */
+    void send(con_hdl_t handle, const nlohmann::json &payload);
+
+    /* Send an update, stamped with a flow trace id while a trace is captured */
+    void send_update(nlohmann::json payload);
+
     /* Auth Message Handler */
-    void on_auth(con_hdl_t handle, nlohmann::json payload);
+    void on_auth(con_hdl_t handle, const Horus::Protocol::AuthMessage &message);
 
     /* Ready Message Handler */
-    void on_ready(con_hdl_t handle, nlohmann::json payload);
+    void on_ready(con_hdl_t handle, const Horus::Protocol::ReadyMessage &message);
 
     /* Update Message Handler */
-    void on_update(con_hdl_t handle, nlohmann::json payload);
+    void on_update(con_hdl_t handle, const Horus::Protocol::UpdateMessage &message);
 
     /* Update Name Handler */
     void update_name(std::string name);
@@ -71,6 +91,9 @@ private:
     con_hdl_t m_handle;
     uint32_t m_guid;
 
+    /* Payload Encoding [requested on run, confirmed by the middleware on open] */
+    Horus::Protocol::Encoding m_encoding = Horus::Protocol::Encoding::json;
+
     /* Server Port */
     std::string m_host = "127.0.0.1";
     uint16_t m_port = 9002;
@@ -106,7 +129,7 @@ Agent::~Agent()
 }
 
 /* Agent Run */
-void Agent::run(std::string host, uint16_t port, std::string name)
+void Agent::run(std::string host, uint16_t port, std::string name, Horus::Protocol::Encoding encoding)
 {
     H_PROFILE_FUNCTION();
 
@@ -127,6 +150,15 @@ void Agent::run(std::string host, uint16_t port, std::string name)
         exit(1);
     }
 
+    /* Request a binary encoding, the middleware falls back to JSON if it does not know it */
+    if (encoding != Horus::Protocol::Encoding::json)
+    {
+        con->add_subprotocol(Horus::Protocol::to_subprotocol(encoding), ec);
+
+        if (ec)
+            H_ERROR("[AGENT] [SUBPROTOCOL] {}", ec.message());
+    }
+
     /* Store Connection Handle */
     m_handle = con->get_handle();
 
@@ -168,9 +200,13 @@ void Agent::on_open(con_hdl_t handle)
 {
     H_PROFILE_FUNCTION();
 
-    m_client.send(handle, nlohmann::json({{"message_type", "auth"}}).dump(), websocketpp::frame::opcode::text);
+    /* No selected subprotocol means the middleware kept JSON */
+    m_encoding = Horus::Protocol::Encoding::json;
+    Horus::Protocol::encoding_from_subprotocol(m_client.get_con_from_hdl(handle)->get_subprotocol(), m_encoding);
+
+    send(handle, nlohmann::json({{"message_type", "auth"}}));
 
-    H_DEBUG("[AGENT] [CONNECTION] [OPEN] host => [{}:{}] channel => [agents]", m_host, m_port);
+    H_DEBUG("[AGENT] [CONNECTION] [OPEN] host => [{}:{}] channel => [agents] encoding => [{}]", m_host, m_port, Horus::Protocol::to_string(m_encoding));
 }
 
 /* Message Handler */
@@ -178,98 +214,92 @@ void Agent::on_message(con_hdl_t handle, client_t::message_ptr message)
 {
     H_PROFILE_FUNCTION();
 
-    nlohmann::json payload;
+    /* Text frames are always JSON, binary frames use the negotiated encoding */
+    Horus::Protocol::Encoding encoding = message->get_opcode() == websocketpp::frame::opcode::text ? Horus::Protocol::Encoding::json : m_encoding;
 
-    std::string message_type = "invalid";
+    nlohmann::json payload = Horus::Protocol::parse(message->get_payload(), encoding);
+    Horus::Protocol::MessageType message_type = Horus::Protocol::message_type_of(payload);
 
-    try
-    {
-        payload = nlohmann::json::parse(message->get_payload());
-        message_type = payload.at("message_type").get<std::string>();
-    }
-    catch (const std::exception &e)
+    if (message_type == Horus::Protocol::MessageType::invalid)
     {
         H_ERROR("[MESSAGE] [MISSING_MESSAGE_TYPE] host => [{}:{}] channel => [agents]", m_host, m_port);
+        return;
     }
 
-    if (message_type == "ready")
-        on_ready(handle, payload);
-    else if (message_type == "update_agent")
-        on_update(handle, payload);
+    using Horus::Protocol::MessageType;
 
-    // H_DEBUG("[AGENT] [MESSAGE] host => [{}:{}] channel => [agents] message => [{}]", m_host, m_port, message->get_payload());
-}
+    switch (message_type)
+    {
+    case MessageType::ready:
+        return dispatch(handle, payload, &Agent::on_ready);
+    case MessageType::update_agent:
+        return dispatch(handle, payload, &Agent::on_update);
+    default:
+        break;
+    }
 
-void Agent::on_auth(con_hdl_t handle, nlohmann::json payload)
-{
-    H_DEBUG("[AGENT] [AUTH] host => [{}:{}] channel => [agents] => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", m_guid}}).dump());
+    // H_DEBUG("[AGENT] [MESSAGE] host => [{}:{}] channel => [agents] message => [{}]", m_host, m_port, message->get_payload());
 }
 
-void Agent::on_ready(con_hdl_t handle, nlohmann::json payload)
+template <typename Message>
+void Agent::dispatch(con_hdl_t handle, const nlohmann::json &payload, void (Agent::*handler)(con_hdl_t, const Message &))
 {
-    uint32_t guid = 0;
-    std::string status = "invalid";
-    std::string name = "invalid";
-    bool state = false;
+    Message message;
 
-    try
+    if (!Horus::Protocol::decode(payload, message))
     {
-        guid = payload.at("guid").get<uint32_t>();
-        name = payload.at("name").get<std::string>();
-        status = payload.at("status").get<std::string>();
-        state = payload.at("state").get<bool>();
-    }
-    catch (const std::exception &e)
-    {
-        H_ERROR("[CLIENT] [READY] [MISSING_GUID] host => [{}:{}] channel => [agents]", m_host, m_port);
+        H_ERROR("[MESSAGE] [MALFORMED] host => [{}:{}] channel => [agents] message_type => [{}]", m_host, m_port, payload.at("message_type").get_ref<const std::string &>());
         return;
     }
 
-    m_status = status;
-    m_state = state;
-    m_guid = guid;
+    (this->*handler)(handle, message);
+}
 
-    H_DEBUG("[CLIENT] [READY] host => [{}:{}] channel => [agents] => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", m_guid}}).dump());
+void Agent::send(con_hdl_t handle, const nlohmann::json &payload)
+{
+    websocketpp::lib::error_code ec;
+    m_client.send(handle, Horus::Protocol::encode(payload, m_encoding), m_encoding == Horus::Protocol::Encoding::json ? websocketpp::frame::opcode::text : websocketpp::frame::opcode::binary, ec);
 
-    /* Send ready back to server */
-    m_client.send(handle, nlohmann::json({{"message_type", "ready"}, {"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", m_guid}}).dump(), websocketpp::frame::opcode::text);
+    if (ec)
+        H_ERROR("[AGENT] [SEND] host => [{}:{}] channel => [agents] {}", m_host, m_port, ec.message());
 }
 
-void Agent::on_update(con_hdl_t handle, nlohmann::json payload)
+void Agent::on_auth(con_hdl_t handle, const Horus::Protocol::AuthMessage &message)
 {
-    uint32_t guid = 0;
-    std::string name = "invalid";
-    std::string status = "open";
-    bool state = false;
+    H_DEBUG("[AGENT] [AUTH] host => [{}:{}] channel => [agents] => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", m_guid}}).dump());
+}
 
-    try
-    {
-        guid = payload.at("guid").get<uint32_t>();
-        name = payload.at("name").get<std::string>();
-        status = payload.at("status").get<std::string>();
-        state = payload.at("state").get<bool>();
-    }
-    catch (const std::exception &e)
-    {
-        H_ERROR("[AGENT] [UPDATE] [MISSING_AGENT_DATA] host => [{}:{}] channel => [agents]", m_host, m_port);
-        return;
-    }
+void Agent::on_ready(con_hdl_t handle, const Horus::Protocol::ReadyMessage &message)
+{
+    m_status = message.status;
+    m_state = message.state;
+    m_guid = message.guid;
+
+    H_DEBUG("[CLIENT] [READY] host => [{}:{}] channel => [agents] => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", m_guid}}).dump());
+
+    /* Send ready back to server */
+    send(handle, nlohmann::json({{"message_type", "ready"}, {"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", m_guid}}));
+}
 
+void Agent::on_update(con_hdl_t handle, const Horus::Protocol::UpdateMessage &message)
+{
     if (m_status != "ready")
     {
         H_ERROR("[AGENT] [UPDATE] [NOT_AUTHORIZED] host => [{}:{}] channel => [agents]", m_host, m_port);
         return;
     }
 
-    m_status = status;
-    m_state = state;
-    m_name = name;
-    H_DEBUG("[CLIENT] [UPDATE] host => [{}:{}] channel => [agents] agent_data => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", guid}}).dump());
-    // m_client.send(m_handle, nlohmann::json({{"message_type", "update_agent"}, {"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", guid}}).dump(), websocketpp::frame::opcode::text);
+    m_status = message.status;
+    m_state = message.state;
+    m_name = message.name;
+    H_DEBUG("[CLIENT] [UPDATE] host => [{}:{}] channel => [agents] agent_data => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", message.guid}}).dump());
+    // send(m_handle, nlohmann::json({{"message_type", "update_agent"}, {"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", message.guid}}));
 }
 
 void Agent::update_name(std::string name)
 {
+    H_PROFILE_FUNCTION();
+
     if (m_status != "ready")
     {
         H_ERROR("[AGENT] [UPDATE] [NOT_AUTHORIZED] host => [{}:{}] channel => [agents]", m_host, m_port);
@@ -277,12 +307,14 @@ void Agent::update_name(std::string name)
     }
 
     H_DEBUG("[CLIENT] [UPDATE] host => [{}:{}] channel => [agents] agent_data => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", m_state}, {"name", name}, {"guid", m_guid}}).dump());
-    m_client.send(m_handle, nlohmann::json({{"message_type", "update_agent"}, {"status", m_status}, {"state", m_state}, {"name", name}, {"guid", m_guid}}).dump(), websocketpp::frame::opcode::text);
-    // on_update(m_handle, nlohmann::json({{"message_type", "update_agent"}, {"status", m_status}, {"state", m_state}, {"name", name}, {"guid", m_guid}}));
+    send_update(nlohmann::json({{"message_type", "update_agent"}, {"status", m_status}, {"state", m_state}, {"name", name}, {"guid", m_guid}}));
+    // on_update(m_handle, Horus::Protocol::UpdateMessage{m_guid, name, m_status, m_state});
 }
 
 void Agent::update_state(bool state)
 {
+    H_PROFILE_FUNCTION();
+
     if (m_status != "ready")
     {
         H_ERROR("[AGENT] [UPDATE] [NOT_AUTHORIZED] host => [{}:{}] channel => [agents]", m_host, m_port);
@@ -290,6 +322,20 @@ void Agent::update_state(bool state)
     }
 
     H_DEBUG("[CLIENT] [UPDATE] host => [{}:{}] channel => [agents] agent_data => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", state}, {"name", m_name}, {"guid", m_guid}}).dump());
-    m_client.send(m_handle, nlohmann::json({{"message_type", "update_agent"}, {"status", m_status}, {"state", state}, {"name", m_name}, {"guid", m_guid}}).dump(), websocketpp::frame::opcode::text);
-    // on_update(m_handle, nlohmann::json({{"message_type", "update_agent"}, {"status", m_status}, {"state", state}, {"name", m_name}, {"guid", m_guid}}));
+    send_update(nlohmann::json({{"message_type", "update_agent"}, {"status", m_status}, {"state", state}, {"name", m_name}, {"guid", m_guid}}));
+    // on_update(m_handle, Horus::Protocol::UpdateMessage{m_guid, m_name, m_status, state});
+}
+
+void Agent::send_update(nlohmann::json payload)
+{
+    /* Traced while capturing, the middleware and the clients record their hops under the same id */
+    uint64_t trace = H_PROFILE_FLOW_ID();
+
+    if (trace)
+    {
+        payload["trace"] = trace;
+        H_PROFILE_FLOW_START("update_agent", trace);
+    }
+
+    send(m_handle, payload);
 }
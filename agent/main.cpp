@@ -16,15 +16,25 @@ int main(int argc, char **argv)
     std::string host;
     uint16_t port = 9002;
     std::string name;
+    std::string encoding_name = "json";
+    uint32_t deflate_window_bits = 15;
+    bool deflate_no_context_takeover = false;
+    std::string trace_file = "agent.trace";
 
     /* Set cli options */
     clipp::group cli(
         clipp::required("-h", "--host").doc("middleware host") & clipp::value("host", host),
         clipp::required("-p", "--port").doc("port to listen on") & clipp::value("port", port),
-        clipp::required("-n", "--name").doc("agent name") & clipp::value("name", name));
+        clipp::required("-n", "--name").doc("agent name") & clipp::value("name", name),
+        clipp::option("-e", "--encoding").doc("payload encoding [json|msgpack|cbor, default: json]") & clipp::value("encoding", encoding_name),
+        clipp::option("--deflate-window-bits").doc("permessage-deflate window bits [8-15, default: 15]") & clipp::value("bits", deflate_window_bits),
+        clipp::option("--deflate-no-context-takeover").set(deflate_no_context_takeover).doc("reset the compressor after every message"),
+        clipp::option("--trace-file").doc("profile output [.json for Chrome JSON, default: agent.trace]") & clipp::value("path", trace_file));
 
     /* Parse the args */
-    if (!clipp::parse(argc, argv, cli))
+    Horus::Protocol::Encoding encoding = Horus::Protocol::Encoding::json;
+
+    if (!clipp::parse(argc, argv, cli) || !Horus::Protocol::encoding_from_string(encoding_name, encoding))
     {
         /* Show help */
         std::cout << clipp::make_man_page(cli, "agent");
@@ -34,8 +44,12 @@ int main(int argc, char **argv)
         return 0;
     }
 
+    /* Compression Tunables [used when built with ENABLE_PERMESSAGE_DEFLATE] */
+    Horus::Deflate::settings().max_window_bits = Horus::Deflate::clamp_window_bits(deflate_window_bits);
+    Horus::Deflate::settings().no_context_takeover = deflate_no_context_takeover;
+
     /* Starts Profile Session */
-    H_PROFILE_BEGIN_SESSION("Application Profile", "profile_results.json");
+    H_PROFILE_BEGIN_SESSION("Application Profile", trace_file);
 
     {
         /* Profiles the Main Function */
@@ -48,7 +62,7 @@ int main(int argc, char **argv)
         Agent agent;
 
         /* Start agent with given host:port */
-        agent.run(host, port, name);
+        agent.run(host, port, name, encoding);
 
         /* Interaction */
         bool done = false;
@@ -60,6 +74,7 @@ int main(int argc, char **argv)
         std::string help = "\n[command]    - [description]\n"
                            "name <text>  - updates the name of the agent\n"
                            "state <0|1>  - update the state of the agent [ON|OFF]\n"
+                           "trace on|off - start or stop trace capture [profiling builds]\n"
                            "quit         - close the connection and quit\n"
                            "help         - show this help message\n";
 
@@ -98,6 +113,17 @@ int main(int argc, char **argv)
 
                 agent.update_state(new_state == '0' ? false : true);
             }
+            else if (input == "trace on" || input == "trace off")
+            {
+#ifdef ENABLE_PROFILING
+                H_PROFILE_CAPTURE(input == "trace on");
+                std::cout << "\ntrace capture => [" << (::Horus::Debug::Instrumentor::Instance().capturing() ? "on" : "off") << "]\n"
+                          << std::endl;
+#else
+                std::cout << "\n!> built without profiling\n"
+                          << std::endl;
+#endif
+            }
             else
                 std::cout << "\n!> unrecognized command\ntype 'help' to see the commands list\n " << std::endl;
         }
@@ -15,12 +15,22 @@
 /* JSON parser */
 #include <nlohmann/json.hpp>
 
+/* Wire Protocol */
+#include "core/protocol.h"
+
+/* Compression Config */
+#include "core/deflate.h"
+
 /* FMT */
 #include <spdlog/fmt/fmt.h>
 #include <spdlog/fmt/bundled/format.h>
 
 /* Server type shortcut */
+#ifdef ENABLE_PERMESSAGE_DEFLATE
+typedef websocketpp::client<Horus::Deflate::Config> client_t;
+#else
 typedef websocketpp::client<websocketpp::config::asio> client_t;
+#endif
 typedef websocketpp::connection_hdl con_hdl_t;
 
 class Client
@@ -30,7 +40,7 @@ public:
     ~Client();
 
     /* Client Loop */
-    void run(std::string host = "127.0.0.1", uint16_t port = 9002, std::string name = "client");
+    void run(std::string host = "127.0.0.1", uint16_t port = 9002, std::string name = "client", Horus::Protocol::Encoding encoding = Horus::Protocol::Encoding::json);
     void stop();
 
     /* Connection Open Handler */
@@ -42,23 +52,60 @@ public:
     /* Message Handler */
     void on_message(con_hdl_t handle, client_t::message_ptr message);
 
+    /* Decoded Message Handler [shared by single frames and batch events] */
+    void handle_message(con_hdl_t handle, Horus::Protocol::MessageType message_type, const nlohmann::json &payload);
+
+    /* Typed Message Dispatch */
+    template <typename Message>
+    void dispatch(con_hdl_t handle, const nlohmann::json &payload, void (Client::*handler)(con_hdl_t, const Message &));
+
+    /* Send a payload with the negotiated encoding */
+    void send(con_hdl_t handle, const nlohmann::json &payload);
+
     /* Auth Message Handler */
-    void on_auth(con_hdl_t handle, nlohmann::json payload);
+    void on_auth(con_hdl_t handle, const Horus::Protocol::AuthMessage &message);
 
     /* Ready Message Handler */
-    void on_ready(con_hdl_t handle, nlohmann::json payload);
+    void on_ready(con_hdl_t handle, const Horus::Protocol::ReadyMessage &message);
 
     /* Update Message Handler */
-    void on_update(con_hdl_t handle, nlohmann::json payload);
+    void on_update(con_hdl_t handle, const Horus::Protocol::UpdateMessage &message);
 
     /* Update New Agent Handler */
-    void on_new_agent(con_hdl_t handle, nlohmann::json payload);
+    void on_new_agent(con_hdl_t handle, const Horus::Protocol::UpdateMessage &message);
 
     /* Update New Client Handler */
-    void on_new_client(con_hdl_t handle, nlohmann::json payload);
+    void on_new_client(con_hdl_t handle, const Horus::Protocol::UpdateMessage &message);
 
     /* Update Update Agent Handler */
-    void on_update_agent(con_hdl_t handle, nlohmann::json payload);
+    void on_update_agent(con_hdl_t handle, const Horus::Protocol::UpdateMessage &message);
+
+    /* Agent Gone Handler [the agent closed or timed out] */
+    void on_agent_gone(con_hdl_t handle, const Horus::Protocol::AgentGoneMessage &message);
+
+    /* Batch Handler [unpacks every event in order] */
+    void on_batch(con_hdl_t handle, const Horus::Protocol::BatchMessage &message);
+
+    /* Snapshot Handler [merges the known agents with the registry state] */
+    void on_snapshot(con_hdl_t handle, const Horus::Protocol::SnapshotMessage &message);
+
+    /* Keep the newest known state of an agent [older versions are ignored] */
+    void apply_agent(const Horus::Protocol::UpdateMessage &agent);
+
+    /* Merge an agent row [call with m_agents_lock held] */
+    void merge_agent(const Horus::Protocol::UpdateMessage &agent);
+
+    /* Forget an agent and remember when it left [call with m_agents_lock held] */
+    void bury_agent(uint32_t guid, uint64_t version);
+
+    /* Ask for every agent change after the newest version seen */
+    void sync();
+
+    /* Copy of the known agents */
+    std::vector<Horus::Protocol::UpdateMessage> agents();
+
+    /* Only hear about the matching agents [an empty filter receives every agent] */
+    void subscribe(const Horus::Protocol::SubscribeMessage &filter);
 
     /* Update Name Handler */
     void update_name(std::string name);
@@ -86,6 +133,19 @@ private:
     con_hdl_t m_handle;
     uint32_t m_guid;
 
+    /* Payload Encoding [requested on run, confirmed by the middleware on open] */
+    Horus::Protocol::Encoding m_encoding = Horus::Protocol::Encoding::json;
+
+    /* Known Agents [guid to newest state, fed by snapshots and deltas] */
+    std::mutex m_agents_lock;
+    std::map<uint32_t, Horus::Protocol::UpdateMessage> m_agents;
+    uint64_t m_registry_version = 0;
+
+    /* Gone Agents [guid to the version it left at, older snapshot rows and deltas cannot bring it back] */
+    std::unordered_map<uint32_t, uint64_t> m_gone;
+    std::deque<uint32_t> m_gone_order;
+    static constexpr std::size_t m_gone_limit = 4096;
+
     /* Server Port */
     std::string m_host = "127.0.0.1";
     uint16_t m_port = 9002;
@@ -121,7 +181,7 @@ Client::~Client()
 }
 
 /* Client Run */
-void Client::run(std::string host, uint16_t port, std::string name)
+void Client::run(std::string host, uint16_t port, std::string name, Horus::Protocol::Encoding encoding)
 {
     H_PROFILE_FUNCTION();
 
@@ -142,6 +202,15 @@ void Client::run(std::string host, uint16_t port, std::string name)
         exit(1);
     }
 
+    /* Request a binary encoding, the middleware falls back to JSON if it does not know it */
+    if (encoding != Horus::Protocol::Encoding::json)
+    {
+        con->add_subprotocol(Horus::Protocol::to_subprotocol(encoding), ec);
+
+        if (ec)
+            H_ERROR("[CLIENT] [SUBPROTOCOL] {}", ec.message());
+    }
+
     /* Store Connection Handle */
     m_handle = con->get_handle();
 
@@ -183,9 +252,13 @@ void Client::on_open(con_hdl_t handle)
 {
     H_PROFILE_FUNCTION();
 
-    m_client.send(handle, nlohmann::json({{"message_type", "auth"}}).dump(), websocketpp::frame::opcode::text);
+    /* No selected subprotocol means the middleware kept JSON */
+    m_encoding = Horus::Protocol::Encoding::json;
+    Horus::Protocol::encoding_from_subprotocol(m_client.get_con_from_hdl(handle)->get_subprotocol(), m_encoding);
+
+    send(handle, nlohmann::json({{"message_type", "auth"}}));
 
-    H_DEBUG("[CLIENT] [CONNECTION] [OPEN] host => [{}:{}] channel => [clients]", m_host, m_port);
+    H_DEBUG("[CLIENT] [CONNECTION] [OPEN] host => [{}:{}] channel => [clients] encoding => [{}]", m_host, m_port, Horus::Protocol::to_string(m_encoding));
 }
 
 /* Message Handler */
@@ -193,185 +266,271 @@ void Client::on_message(con_hdl_t handle, client_t::message_ptr message)
 {
     H_PROFILE_FUNCTION();
 
-    nlohmann::json payload;
+    /* Text frames are always JSON, binary frames use the negotiated encoding */
+    Horus::Protocol::Encoding encoding = message->get_opcode() == websocketpp::frame::opcode::text ? Horus::Protocol::Encoding::json : m_encoding;
 
-    std::string message_type = "invalid";
+    nlohmann::json payload = Horus::Protocol::parse(message->get_payload(), encoding);
+    Horus::Protocol::MessageType message_type = Horus::Protocol::message_type_of(payload);
 
-    try
-    {
-        payload = nlohmann::json::parse(message->get_payload());
-        message_type = payload.at("message_type").get<std::string>();
-    }
-    catch (const std::exception &e)
+    if (message_type == Horus::Protocol::MessageType::invalid)
     {
         H_ERROR("[MESSAGE] [MISSING_MESSAGE_TYPE] host => [{}:{}] channel => [clients]", m_host, m_port);
+        return;
     }
 
-    if (message_type == "ready")
-        on_ready(handle, payload);
-    else if (message_type == "new_client")
-        on_new_client(handle, payload);
-    else if (message_type == "new_agent")
-        on_new_agent(handle, payload);
-    else if (message_type == "update_agent")
-        on_update_agent(handle, payload);
+    handle_message(handle, message_type, payload);
 
     // H_DEBUG("[CLIENT] [MESSAGE] host => [{}:{}] channel => [clients] message => [{}]", m_host, m_port, message->get_payload());
 }
 
-void Client::on_auth(con_hdl_t handle, nlohmann::json payload)
+void Client::handle_message(con_hdl_t handle, Horus::Protocol::MessageType message_type, const nlohmann::json &payload)
 {
-    H_DEBUG("[CLIENT] [AUTH] host => [{}:{}] channel => [clients] => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", m_guid}}).dump());
+    using Horus::Protocol::MessageType;
+
+    switch (message_type)
+    {
+    case MessageType::ready:
+        return dispatch(handle, payload, &Client::on_ready);
+    case MessageType::new_client:
+        return dispatch(handle, payload, &Client::on_new_client);
+    case MessageType::new_agent:
+        return dispatch(handle, payload, &Client::on_new_agent);
+    case MessageType::update_agent:
+        return dispatch(handle, payload, &Client::on_update_agent);
+    case MessageType::agent_gone:
+        return dispatch(handle, payload, &Client::on_agent_gone);
+    case MessageType::batch:
+        return dispatch(handle, payload, &Client::on_batch);
+    case MessageType::snapshot:
+        return dispatch(handle, payload, &Client::on_snapshot);
+    default:
+        break;
+    }
 }
 
-void Client::on_ready(con_hdl_t handle, nlohmann::json payload)
+template <typename Message>
+void Client::dispatch(con_hdl_t handle, const nlohmann::json &payload, void (Client::*handler)(con_hdl_t, const Message &))
 {
-    uint32_t guid = 0;
-    std::string status = "invalid";
-    std::string name = "invalid";
-    bool state = false;
+    Message message;
 
-    try
-    {
-        guid = payload.at("guid").get<uint32_t>();
-        name = payload.at("name").get<std::string>();
-        status = payload.at("status").get<std::string>();
-        state = payload.at("state").get<bool>();
-    }
-    catch (const std::exception &e)
+    if (!Horus::Protocol::decode(payload, message))
     {
-        H_ERROR("[CLIENT] [READY] [MISSING_GUID] host => [{}:{}] channel => [clients]", m_host, m_port);
+        H_ERROR("[MESSAGE] [MALFORMED] host => [{}:{}] channel => [clients] message_type => [{}]", m_host, m_port, payload.at("message_type").get_ref<const std::string &>());
         return;
     }
 
-    m_status = status;
-    m_state = state;
-    m_guid = guid;
+    (this->*handler)(handle, message);
+}
 
-    H_DEBUG("[CLIENT] [READY] host => [{}:{}] channel => [clients] => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", m_guid}}).dump());
+void Client::send(con_hdl_t handle, const nlohmann::json &payload)
+{
+    websocketpp::lib::error_code ec;
+    m_client.send(handle, Horus::Protocol::encode(payload, m_encoding), m_encoding == Horus::Protocol::Encoding::json ? websocketpp::frame::opcode::text : websocketpp::frame::opcode::binary, ec);
 
-    /* Send ready back to server */
-    m_client.send(handle, nlohmann::json({{"message_type", "ready"}, {"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", m_guid}}).dump(), websocketpp::frame::opcode::text);
+    if (ec)
+        H_ERROR("[CLIENT] [SEND] host => [{}:{}] channel => [clients] {}", m_host, m_port, ec.message());
 }
 
-void Client::on_update(con_hdl_t handle, nlohmann::json payload)
+void Client::on_auth(con_hdl_t handle, const Horus::Protocol::AuthMessage &message)
 {
-    uint32_t guid = 0;
-    std::string name = "invalid";
-    std::string status = "open";
-    bool state = false;
+    H_DEBUG("[CLIENT] [AUTH] host => [{}:{}] channel => [clients] => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", m_guid}}).dump());
+}
 
-    try
-    {
-        guid = payload.at("guid").get<uint32_t>();
-        name = payload.at("name").get<std::string>();
-        status = payload.at("status").get<std::string>();
-        state = payload.at("state").get<bool>();
-    }
-    catch (const std::exception &e)
-    {
-        H_ERROR("[CLIENT] [UPDATE] [MISSING_CLIENT_DATA] host => [{}:{}] channel => [clients]", m_host, m_port);
-        return;
-    }
+void Client::on_ready(con_hdl_t handle, const Horus::Protocol::ReadyMessage &message)
+{
+    m_status = message.status;
+    m_state = message.state;
+    m_guid = message.guid;
+
+    H_DEBUG("[CLIENT] [READY] host => [{}:{}] channel => [clients] => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", m_guid}}).dump());
 
+    /* Send ready back to server */
+    send(handle, nlohmann::json({{"message_type", "ready"}, {"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", m_guid}}));
+}
+
+void Client::on_update(con_hdl_t handle, const Horus::Protocol::UpdateMessage &message)
+{
     if (m_status != "ready")
     {
         H_ERROR("[CLIENT] [UPDATE] [NOT_AUTHORIZED] host => [{}:{}] channel => [clients]", m_host, m_port);
         return;
     }
 
-    m_status = status;
-    m_state = state;
-    m_name = name;
-    H_DEBUG("[CLIENT] [UPDATE] host => [{}:{}] channel => [clients] client_data => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", guid}}).dump());
-    m_client.send(m_handle, nlohmann::json({{"message_type", "update_client"}, {"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", guid}}).dump(), websocketpp::frame::opcode::text);
+    m_status = message.status;
+    m_state = message.state;
+    m_name = message.name;
+    H_DEBUG("[CLIENT] [UPDATE] host => [{}:{}] channel => [clients] client_data => [{}]", m_host, m_port, nlohmann::json({{"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", message.guid}}).dump());
+    send(m_handle, nlohmann::json({{"message_type", "update_client"}, {"status", m_status}, {"state", m_state}, {"name", m_name}, {"guid", message.guid}}));
+}
+
+void Client::on_new_agent(con_hdl_t handle, const Horus::Protocol::UpdateMessage &message)
+{
+    apply_agent(message);
+    H_DEBUG("[CLIENT] [NEW_AGENT] host => [{}:{}] channel => [clients] client_data => [{}]", m_host, m_port, nlohmann::json({{"status", message.status}, {"state", message.state}, {"name", message.name}, {"guid", message.guid}}).dump());
 }
 
-void Client::on_new_agent(con_hdl_t handle, nlohmann::json payload)
+void Client::on_new_client(con_hdl_t handle, const Horus::Protocol::UpdateMessage &message)
 {
-    uint32_t guid = 0;
-    std::string name = "invalid";
-    std::string status = "open";
-    bool state = false;
+    H_DEBUG("[CLIENT] [NEW_CLIENT] host => [{}:{}] channel => [clients] client_data => [{}]", m_host, m_port, nlohmann::json({{"status", message.status}, {"state", message.state}, {"name", message.name}, {"guid", message.guid}}).dump());
+}
+
+void Client::on_update_agent(con_hdl_t handle, const Horus::Protocol::UpdateMessage &message)
+{
+    H_PROFILE_FLOW_END("update_agent", message.trace);
 
-    try
+    apply_agent(message);
+    H_DEBUG("[CLIENT] [UPDATE_AGENT] host => [{}:{}] channel => [clients] client_data => [{}]", m_host, m_port, nlohmann::json({{"status", message.status}, {"state", message.state}, {"name", message.name}, {"guid", message.guid}}).dump());
+}
+
+void Client::on_batch(con_hdl_t handle, const Horus::Protocol::BatchMessage &message)
+{
+    for (const nlohmann::json &event : message.events)
     {
-        guid = payload.at("guid").get<uint32_t>();
-        name = payload.at("name").get<std::string>();
-        status = payload.at("status").get<std::string>();
-        state = payload.at("state").get<bool>();
+        Horus::Protocol::MessageType message_type = Horus::Protocol::message_type_of(event);
+
+        /* Batches are never nested */
+        if (message_type == Horus::Protocol::MessageType::invalid || message_type == Horus::Protocol::MessageType::batch)
+        {
+            H_ERROR("[MESSAGE] [BATCH] [INVALID_EVENT] host => [{}:{}] channel => [clients]", m_host, m_port);
+            continue;
+        }
+
+        handle_message(handle, message_type, event);
     }
-    catch (const std::exception &e)
+}
+
+void Client::on_agent_gone(con_hdl_t handle, const Horus::Protocol::AgentGoneMessage &message)
+{
     {
-        H_ERROR("[CLIENT] [NEW_AGENT] [MISSING_AGENT_DATA] host => [{}:{}] channel => [clients]", m_host, m_port);
-        return;
+        std::lock_guard<std::mutex> lock(m_agents_lock);
+        bury_agent(message.guid, message.version);
+        m_registry_version = std::max(m_registry_version, message.version);
     }
 
-    H_DEBUG("[CLIENT] [NEW_AGENT] host => [{}:{}] channel => [clients] client_data => [{}]", m_host, m_port, nlohmann::json({{"status", status}, {"state", state}, {"name", name}, {"guid", guid}}).dump());
+    H_DEBUG("[CLIENT] [AGENT_GONE] host => [{}:{}] channel => [clients] guid => [{}]", m_host, m_port, message.guid);
 }
 
-void Client::on_new_client(con_hdl_t handle, nlohmann::json payload)
+void Client::on_snapshot(con_hdl_t handle, const Horus::Protocol::SnapshotMessage &message)
 {
-    uint32_t guid = 0;
-    std::string name = "invalid";
-    std::string status = "open";
-    bool state = false;
-
-    try
     {
-        guid = payload.at("guid").get<uint32_t>();
-        name = payload.at("name").get<std::string>();
-        status = payload.at("status").get<std::string>();
-        state = payload.at("state").get<bool>();
+        std::lock_guard<std::mutex> lock(m_agents_lock);
+
+        /* A full snapshot drops the agents it no longer lists [a subscription may have narrowed them], deltas newer than it stay */
+        if (message.since == 0)
+        {
+            std::set<uint32_t> listed;
+            for (const Horus::Protocol::UpdateMessage &agent : message.agents)
+                listed.insert(agent.guid);
+
+            for (auto it = m_agents.begin(); it != m_agents.end();)
+            {
+                if (it->second.version <= message.version && listed.count(it->first) == 0)
+                    it = m_agents.erase(it);
+                else
+                    ++it;
+            }
+        }
+
+        for (const Horus::Protocol::UpdateMessage &agent : message.agents)
+            merge_agent(agent);
+
+        for (uint32_t guid : message.gone)
+            bury_agent(guid, message.version);
+
+        m_registry_version = std::max(m_registry_version, message.version);
     }
-    catch (const std::exception &e)
-    {
-        H_ERROR("[CLIENT] [NEW_CLIENT] [MISSING_CLIENT_DATA] host => [{}:{}] channel => [clients]", m_host, m_port);
+
+    H_DEBUG("[CLIENT] [SNAPSHOT] host => [{}:{}] channel => [clients] since => [{}] version => [{}] agents => [{}]", m_host, m_port, message.since, message.version, message.agents.size());
+}
+
+void Client::apply_agent(const Horus::Protocol::UpdateMessage &agent)
+{
+    std::lock_guard<std::mutex> lock(m_agents_lock);
+    merge_agent(agent);
+}
+
+void Client::merge_agent(const Horus::Protocol::UpdateMessage &agent)
+{
+    /* An agent_gone may overtake the rows read before it, those cannot revive the agent */
+    auto gone = m_gone.find(agent.guid);
+    if (gone != m_gone.end() && agent.version <= gone->second)
+        return;
+
+    /* A delta may overtake the snapshot it follows, keep whichever is newer */
+    auto it = m_agents.find(agent.guid);
+    if (it != m_agents.end() && agent.version != 0 && it->second.version >= agent.version)
         return;
-    }
 
-    H_DEBUG("[CLIENT] [NEW_CLIENT] host => [{}:{}] channel => [clients] client_data => [{}]", m_host, m_port, nlohmann::json({{"status", status}, {"state", state}, {"name", name}, {"guid", guid}}).dump());
+    m_agents[agent.guid] = agent;
+    m_registry_version = std::max(m_registry_version, agent.version);
 }
 
-void Client::on_update_agent(con_hdl_t handle, nlohmann::json payload)
+void Client::bury_agent(uint32_t guid, uint64_t version)
 {
-    uint32_t guid = 0;
-    std::string name = "invalid";
-    std::string status = "open";
-    bool state = false;
+    m_agents.erase(guid);
 
-    try
+    auto it = m_gone.find(guid);
+    if (it != m_gone.end())
     {
-        guid = payload.at("guid").get<uint32_t>();
-        name = payload.at("name").get<std::string>();
-        status = payload.at("status").get<std::string>();
-        state = payload.at("state").get<bool>();
+        it->second = std::max(it->second, version);
+        return;
     }
-    catch (const std::exception &e)
+
+    /* Bounded like the middleware tombstones, the oldest go first */
+    m_gone.emplace(guid, version);
+    m_gone_order.push_back(guid);
+
+    if (m_gone_order.size() > m_gone_limit)
     {
-        H_ERROR("[CLIENT] [UPDATE_AGENT] [MISSING_AGENT_DATA] host => [{}:{}] channel => [clients]", m_host, m_port);
-        return;
+        m_gone.erase(m_gone_order.front());
+        m_gone_order.pop_front();
+    }
+}
+
+void Client::sync()
+{
+    uint64_t since = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_agents_lock);
+        since = m_registry_version;
     }
 
-    H_DEBUG("[CLIENT] [UPDATE_AGENT] host => [{}:{}] channel => [clients] client_data => [{}]", m_host, m_port, nlohmann::json({{"status", status}, {"state", state}, {"name", name}, {"guid", guid}}).dump());
+    send(m_handle, nlohmann::json({{"message_type", "sync"}, {"since", since}}));
+}
+
+std::vector<Horus::Protocol::UpdateMessage> Client::agents()
+{
+    std::lock_guard<std::mutex> lock(m_agents_lock);
+
+    std::vector<Horus::Protocol::UpdateMessage> result;
+    for (const auto &agent : m_agents)
+        result.push_back(agent.second);
+
+    return result;
+}
+
+void Client::subscribe(const Horus::Protocol::SubscribeMessage &filter)
+{
+    send(m_handle, nlohmann::json({{"message_type", "subscribe"}, {"guids", filter.guids}, {"ranges", filter.ranges}, {"prefixes", filter.prefixes}}));
 }
 
 void Client::update_name(std::string name)
 {
-    on_update(m_handle, nlohmann::json({{"message_type", "update_client"}, {"status", m_status}, {"state", m_state}, {"name", name}, {"guid", m_guid}}));
+    on_update(m_handle, Horus::Protocol::UpdateMessage{m_guid, name, m_status, m_state});
 }
 
 void Client::update_state(bool state)
 {
-    on_update(m_handle, nlohmann::json({{"message_type", "update_client"}, {"status", m_status}, {"state", state}, {"name", m_name}, {"guid", m_guid}}));
+    on_update(m_handle, Horus::Protocol::UpdateMessage{m_guid, m_name, m_status, state});
 }
 
 void Client::update_agent_name(std::string name, uint32_t guid)
 {
-    m_client.send(m_handle, nlohmann::json({{"message_type", "update_agent_name"}, {"name", name}, {"guid", guid}}).dump(), websocketpp::frame::opcode::text);
+    send(m_handle, nlohmann::json({{"message_type", "update_agent_name"}, {"name", name}, {"guid", guid}}));
 }
 
 void Client::update_agent_state(bool state, uint32_t guid)
 {
-    m_client.send(m_handle, nlohmann::json({{"message_type", "update_agent_state"}, {"state", state}, {"guid", guid}}).dump(), websocketpp::frame::opcode::text);
+    send(m_handle, nlohmann::json({{"message_type", "update_agent_state"}, {"state", state}, {"guid", guid}}));
 }
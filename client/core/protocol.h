@@ -0,0 +1,749 @@
+/**
+ * @file protocol.h
+ * @brief Wire Protocol Shared by Middleware, Agent and Client
+ *
+ * Keep the copies under middleware/, agent/ and client/ identical.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <stdexcept>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include <nlohmann/json.hpp>
+
+namespace Horus
+{
+    namespace Protocol
+    {
+        /**
+         * @brief Every message_type understood on the wire
+         *
+         */
+        enum class MessageType : uint8_t
+        {
+            invalid,
+            auth,
+            ready,
+            new_agent,
+            new_client,
+            update_agent,
+            update_client,
+            update_agent_name,
+            update_agent_state,
+            batch,
+            snapshot,
+            sync,
+            subscribe,
+            agent_gone
+        };
+
+        /* Number of message types [agent_gone must stay the last one] */
+        constexpr std::size_t message_type_count = static_cast<std::size_t>(MessageType::agent_gone) + 1;
+
+        /**
+         * @brief Wire name of a message type
+         *
+         */
+        constexpr const char *to_string(MessageType type)
+        {
+            switch (type)
+            {
+            case MessageType::auth:
+                return "auth";
+            case MessageType::ready:
+                return "ready";
+            case MessageType::new_agent:
+                return "new_agent";
+            case MessageType::new_client:
+                return "new_client";
+            case MessageType::update_agent:
+                return "update_agent";
+            case MessageType::update_client:
+                return "update_client";
+            case MessageType::update_agent_name:
+                return "update_agent_name";
+            case MessageType::update_agent_state:
+                return "update_agent_state";
+            case MessageType::batch:
+                return "batch";
+            case MessageType::snapshot:
+                return "snapshot";
+            case MessageType::sync:
+                return "sync";
+            case MessageType::subscribe:
+                return "subscribe";
+            case MessageType::agent_gone:
+                return "agent_gone";
+            default:
+                return "invalid";
+            }
+        }
+
+        /**
+         * @brief Resolve a wire name into its message type
+         *
+         * The length picks the only candidate [auth and sync, ready and batch,
+         * new_agent and subscribe, new_client and agent_gone share theirs and
+         * are told apart by the first byte] and a single comparison confirms it.
+         */
+        constexpr MessageType message_type_from_string(std::string_view type)
+        {
+            MessageType candidate = MessageType::invalid;
+
+            switch (type.size())
+            {
+            case 4:
+                candidate = type[0] == 's' ? MessageType::sync : MessageType::auth;
+                break;
+            case 5:
+                candidate = type[0] == 'b' ? MessageType::batch : MessageType::ready;
+                break;
+            case 8:
+                candidate = MessageType::snapshot;
+                break;
+            case 9:
+                candidate = type[0] == 's' ? MessageType::subscribe : MessageType::new_agent;
+                break;
+            case 10:
+                candidate = type[0] == 'a' ? MessageType::agent_gone : MessageType::new_client;
+                break;
+            case 12:
+                candidate = MessageType::update_agent;
+                break;
+            case 13:
+                candidate = MessageType::update_client;
+                break;
+            case 17:
+                candidate = MessageType::update_agent_name;
+                break;
+            case 18:
+                candidate = MessageType::update_agent_state;
+                break;
+            default:
+                return MessageType::invalid;
+            }
+
+            return type == to_string(candidate) ? candidate : MessageType::invalid;
+        }
+
+        static_assert(message_type_from_string("auth") == MessageType::auth);
+        static_assert(message_type_from_string("ready") == MessageType::ready);
+        static_assert(message_type_from_string("new_agent") == MessageType::new_agent);
+        static_assert(message_type_from_string("new_client") == MessageType::new_client);
+        static_assert(message_type_from_string("update_agent") == MessageType::update_agent);
+        static_assert(message_type_from_string("update_client") == MessageType::update_client);
+        static_assert(message_type_from_string("update_agent_name") == MessageType::update_agent_name);
+        static_assert(message_type_from_string("update_agent_state") == MessageType::update_agent_state);
+        static_assert(message_type_from_string("batch") == MessageType::batch);
+        static_assert(message_type_from_string("bread") == MessageType::invalid);
+        static_assert(message_type_from_string("snapshot") == MessageType::snapshot);
+        static_assert(message_type_from_string("sync") == MessageType::sync);
+        static_assert(message_type_from_string("subscribe") == MessageType::subscribe);
+        static_assert(message_type_from_string("agent_gone") == MessageType::agent_gone);
+        static_assert(message_type_from_string("update_agent_stats") == MessageType::invalid);
+
+        /**
+         * @brief auth [no fields]
+         *
+         */
+        struct AuthMessage
+        {
+        };
+
+        /**
+         * @brief ready [status is only sent by the middleware]
+         *
+         */
+        struct ReadyMessage
+        {
+            uint32_t guid = 0;
+            std::string name;
+            std::string status = "open";
+            bool state = false;
+        };
+
+        /**
+         * @brief new_agent, new_client, update_agent and update_client
+         *
+         * version is the registry version of the change, only set on agent
+         * events sent by the middleware. trace is the optional flow id an
+         * agent stamps while it captures a trace, relayed as is.
+         */
+        struct UpdateMessage
+        {
+            uint32_t guid = 0;
+            std::string name;
+            std::string status;
+            bool state = false;
+            uint64_t version = 0;
+            uint64_t trace = 0;
+        };
+
+        /**
+         * @brief update_agent_name
+         *
+         */
+        struct UpdateNameMessage
+        {
+            uint32_t guid = 0;
+            std::string name;
+        };
+
+        /**
+         * @brief update_agent_state
+         *
+         */
+        struct UpdateStateMessage
+        {
+            uint32_t guid = 0;
+            bool state = false;
+        };
+
+        /**
+         * @brief batch [events holds complete messages, each with its own message_type]
+         *
+         */
+        struct BatchMessage
+        {
+            nlohmann::json events = nlohmann::json::array();
+        };
+
+        /**
+         * @brief sync [ask for every agent change after a registry version]
+         *
+         */
+        struct SyncMessage
+        {
+            uint64_t since = 0;
+        };
+
+        /**
+         * @brief snapshot [agents changed after since, as of version]
+         *
+         * Agents travel as parallel columns instead of one object each, gone
+         * lists the agents that left after since. A snapshot answering an
+         * older since than the middleware remembers comes back with since 0.
+         */
+        struct SnapshotMessage
+        {
+            uint64_t version = 0;
+            uint64_t since = 0;
+            std::vector<UpdateMessage> agents;
+            std::vector<uint32_t> gone;
+        };
+
+        /**
+         * @brief agent_gone [an agent closed or timed out, its guid is no longer valid]
+         *
+         */
+        struct AgentGoneMessage
+        {
+            uint32_t guid = 0;
+            uint64_t version = 0;
+        };
+
+        /**
+         * @brief subscribe [agents matching any guid, inclusive range or name prefix]
+         *
+         * Every field is optional, a subscribe without any returns to receiving
+         * every agent.
+         */
+        struct SubscribeMessage
+        {
+            std::vector<uint32_t> guids;
+            std::vector<std::pair<uint32_t, uint32_t>> ranges;
+            std::vector<std::string> prefixes;
+
+            bool everything() const { return guids.empty() && ranges.empty() && prefixes.empty(); }
+        };
+
+        /* JSON decoding [throws on missing or mistyped fields] */
+        inline void from_json(const nlohmann::json &, AuthMessage &)
+        {
+        }
+
+        inline void from_json(const nlohmann::json &payload, ReadyMessage &message)
+        {
+            payload.at("guid").get_to(message.guid);
+            payload.at("name").get_to(message.name);
+            payload.at("state").get_to(message.state);
+            message.status = payload.value("status", message.status);
+        }
+
+        inline void from_json(const nlohmann::json &payload, UpdateMessage &message)
+        {
+            payload.at("guid").get_to(message.guid);
+            payload.at("name").get_to(message.name);
+            payload.at("status").get_to(message.status);
+            payload.at("state").get_to(message.state);
+            message.version = payload.value("version", message.version);
+            message.trace = payload.value("trace", message.trace);
+        }
+
+        inline void from_json(const nlohmann::json &payload, UpdateNameMessage &message)
+        {
+            payload.at("guid").get_to(message.guid);
+            payload.at("name").get_to(message.name);
+        }
+
+        inline void from_json(const nlohmann::json &payload, UpdateStateMessage &message)
+        {
+            payload.at("guid").get_to(message.guid);
+            payload.at("state").get_to(message.state);
+        }
+
+        inline void from_json(const nlohmann::json &payload, BatchMessage &message)
+        {
+            const nlohmann::json &events = payload.at("events");
+
+            if (!events.is_array())
+                throw std::invalid_argument("events is not an array");
+
+            message.events = events;
+        }
+
+        inline void from_json(const nlohmann::json &payload, SubscribeMessage &message)
+        {
+            message.guids = payload.value("guids", std::vector<uint32_t>());
+            message.ranges = payload.value("ranges", std::vector<std::pair<uint32_t, uint32_t>>());
+            message.prefixes = payload.value("prefixes", std::vector<std::string>());
+
+            for (const std::pair<uint32_t, uint32_t> &range : message.ranges)
+                if (range.first > range.second)
+                    throw std::invalid_argument("range ends before it starts");
+        }
+
+        inline void from_json(const nlohmann::json &payload, SyncMessage &message)
+        {
+            payload.at("since").get_to(message.since);
+        }
+
+        inline void from_json(const nlohmann::json &payload, SnapshotMessage &message)
+        {
+            payload.at("version").get_to(message.version);
+            payload.at("since").get_to(message.since);
+
+            const nlohmann::json &agents = payload.at("agents");
+            const nlohmann::json &guids = agents.at("guid");
+            const nlohmann::json &names = agents.at("name");
+            const nlohmann::json &statuses = agents.at("status");
+            const nlohmann::json &states = agents.at("state");
+            const nlohmann::json &versions = agents.at("version");
+
+            std::size_t count = guids.size();
+
+            if (!guids.is_array() || names.size() != count || statuses.size() != count || states.size() != count || versions.size() != count)
+                throw std::invalid_argument("agents columns differ in length");
+
+            message.agents.resize(count);
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                guids.at(i).get_to(message.agents[i].guid);
+                names.at(i).get_to(message.agents[i].name);
+                statuses.at(i).get_to(message.agents[i].status);
+                states.at(i).get_to(message.agents[i].state);
+                versions.at(i).get_to(message.agents[i].version);
+            }
+
+            message.gone = payload.value("gone", std::vector<uint32_t>());
+        }
+
+        inline void from_json(const nlohmann::json &payload, AgentGoneMessage &message)
+        {
+            payload.at("guid").get_to(message.guid);
+            payload.at("version").get_to(message.version);
+        }
+
+        /**
+         * @brief Empty agent columns of a snapshot message
+         *
+         */
+        inline nlohmann::json make_snapshot_columns()
+        {
+            return nlohmann::json({{"guid", nlohmann::json::array()}, {"name", nlohmann::json::array()}, {"status", nlohmann::json::array()}, {"state", nlohmann::json::array()}, {"version", nlohmann::json::array()}});
+        }
+
+        /**
+         * @brief Wrap complete messages into a single batch message
+         *
+         */
+        inline nlohmann::json make_batch(nlohmann::json events)
+        {
+            return nlohmann::json({{"message_type", to_string(MessageType::batch)}, {"events", std::move(events)}});
+        }
+
+        /**
+         * @brief Decode a payload into its typed message
+         *
+         * @return false if a field is missing or has the wrong type
+         */
+        template <typename Message>
+        bool decode(const nlohmann::json &payload, Message &message)
+        {
+            try
+            {
+                from_json(payload, message);
+            }
+            catch (const std::exception &e)
+            {
+                return false;
+            }
+
+            return true;
+        }
+
+        /**
+         * @brief Read the message type of a payload
+         *
+         */
+        inline MessageType message_type_of(const nlohmann::json &payload)
+        {
+            auto it = payload.find("message_type");
+
+            if (it == payload.end() || !it->is_string())
+                return MessageType::invalid;
+
+            return message_type_from_string(it->get_ref<const std::string &>());
+        }
+
+        /**
+         * @brief Read the flow trace id of a payload
+         *
+         * @return zero for untraced messages
+         */
+        inline uint64_t trace_of(const nlohmann::json &payload)
+        {
+            auto it = payload.find("trace");
+
+            if (it == payload.end() || !it->is_number_unsigned())
+                return 0;
+
+            return it->get<uint64_t>();
+        }
+
+        /**
+         * @brief Payload encoding of a connection
+         *
+         * Negotiated once per connection through the WebSocket subprotocol.
+         * Peers that request none keep talking JSON text frames.
+         */
+        enum class Encoding : uint8_t
+        {
+            json,
+            msgpack,
+            cbor
+        };
+
+        /**
+         * @brief Command line name of an encoding
+         *
+         */
+        constexpr const char *to_string(Encoding encoding)
+        {
+            switch (encoding)
+            {
+            case Encoding::msgpack:
+                return "msgpack";
+            case Encoding::cbor:
+                return "cbor";
+            default:
+                return "json";
+            }
+        }
+
+        /**
+         * @brief Subprotocol name announcing an encoding
+         *
+         */
+        constexpr const char *to_subprotocol(Encoding encoding)
+        {
+            switch (encoding)
+            {
+            case Encoding::msgpack:
+                return "horus.msgpack";
+            case Encoding::cbor:
+                return "horus.cbor";
+            default:
+                return "horus.json";
+            }
+        }
+
+        /**
+         * @brief Resolve a subprotocol name into its encoding
+         *
+         * @return false if the name is not one of ours
+         */
+        inline bool encoding_from_subprotocol(std::string_view subprotocol, Encoding &encoding)
+        {
+            for (Encoding candidate : {Encoding::json, Encoding::msgpack, Encoding::cbor})
+            {
+                if (subprotocol == to_subprotocol(candidate))
+                {
+                    encoding = candidate;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /**
+         * @brief Resolve a command line name [json, msgpack, cbor] into its encoding
+         *
+         * @return false if the name is unknown
+         */
+        inline bool encoding_from_string(std::string_view name, Encoding &encoding)
+        {
+            for (Encoding candidate : {Encoding::json, Encoding::msgpack, Encoding::cbor})
+            {
+                if (name == to_string(candidate))
+                {
+                    encoding = candidate;
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /**
+         * @brief Check a string is well formed UTF-8
+         *
+         * Follows RFC 3629: no overlong forms, no surrogates, nothing above
+         * U+10FFFF.
+         */
+        inline bool valid_utf8(std::string_view text)
+        {
+            std::size_t i = 0;
+
+            while (i < text.size())
+            {
+                unsigned char lead = static_cast<unsigned char>(text[i]);
+
+                if (lead < 0x80)
+                {
+                    ++i;
+                    continue;
+                }
+
+                std::size_t length = 0;
+                uint32_t code_point = 0;
+                uint32_t minimum = 0;
+
+                if ((lead & 0xe0) == 0xc0)
+                {
+                    length = 2;
+                    code_point = lead & 0x1f;
+                    minimum = 0x80;
+                }
+                else if ((lead & 0xf0) == 0xe0)
+                {
+                    length = 3;
+                    code_point = lead & 0x0f;
+                    minimum = 0x800;
+                }
+                else if ((lead & 0xf8) == 0xf0)
+                {
+                    length = 4;
+                    code_point = lead & 0x07;
+                    minimum = 0x10000;
+                }
+                else
+                    return false;
+
+                if (text.size() - i < length)
+                    return false;
+
+                for (std::size_t k = 1; k < length; ++k)
+                {
+                    unsigned char next = static_cast<unsigned char>(text[i + k]);
+
+                    if ((next & 0xc0) != 0x80)
+                        return false;
+
+                    code_point = (code_point << 6) | (next & 0x3f);
+                }
+
+                if (code_point < minimum || code_point > 0x10ffff || (code_point >= 0xd800 && code_point <= 0xdfff))
+                    return false;
+
+                i += length;
+            }
+
+            return true;
+        }
+
+        /**
+         * @brief Check every string and object key of a value is valid UTF-8
+         *
+         * The MessagePack and CBOR readers take strings as they come, the
+         * JSON serializer throws on the first invalid one.
+         */
+        inline bool valid_strings(const nlohmann::json &value)
+        {
+            /* Walked with an explicit stack, the nesting of a value never reaches the call stack */
+            std::vector<const nlohmann::json *> pending{&value};
+
+            while (!pending.empty())
+            {
+                const nlohmann::json *current = pending.back();
+                pending.pop_back();
+
+                switch (current->type())
+                {
+                case nlohmann::json::value_t::string:
+                    if (!valid_utf8(current->get_ref<const std::string &>()))
+                        return false;
+                    break;
+                case nlohmann::json::value_t::array:
+                    for (const nlohmann::json &element : *current)
+                        pending.push_back(&element);
+                    break;
+                case nlohmann::json::value_t::object:
+                    for (auto it = current->begin(); it != current->end(); ++it)
+                    {
+                        if (!valid_utf8(it.key()))
+                            return false;
+
+                        pending.push_back(&it.value());
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            return true;
+        }
+
+        /* Nesting allowed in a binary payload [the MessagePack and CBOR readers recurse once per level] */
+        constexpr std::size_t max_depth = 64;
+
+        /**
+         * @brief Builds the value of a binary payload, failing past max_depth
+         *
+         * Refusing the container that would go one level too deep stops the
+         * reader before it recurses, so a frame of nested arrays cannot
+         * overflow the stack of the thread parsing it.
+         */
+        class BoundedSax
+        {
+        private:
+            nlohmann::detail::json_sax_dom_parser<nlohmann::json> m_dom;
+            std::size_t m_depth = 0;
+
+        public:
+            explicit BoundedSax(nlohmann::json &result)
+                : m_dom(result, false)
+            {
+            }
+
+            bool null() { return m_dom.null(); }
+            bool boolean(bool value) { return m_dom.boolean(value); }
+            bool number_integer(nlohmann::json::number_integer_t value) { return m_dom.number_integer(value); }
+            bool number_unsigned(nlohmann::json::number_unsigned_t value) { return m_dom.number_unsigned(value); }
+            bool number_float(nlohmann::json::number_float_t value, const std::string &text) { return m_dom.number_float(value, text); }
+            bool string(std::string &value) { return m_dom.string(value); }
+            bool binary(nlohmann::json::binary_t &value) { return m_dom.binary(value); }
+            bool key(std::string &value) { return m_dom.key(value); }
+
+            bool start_object(std::size_t elements) { return ++m_depth <= max_depth && m_dom.start_object(elements); }
+            bool end_object() { --m_depth; return m_dom.end_object(); }
+            bool start_array(std::size_t elements) { return ++m_depth <= max_depth && m_dom.start_array(elements); }
+            bool end_array() { --m_depth; return m_dom.end_array(); }
+
+            template <typename Exception>
+            bool parse_error(std::size_t position, const std::string &token, const Exception &error)
+            {
+                return m_dom.parse_error(position, token, error);
+            }
+
+            bool is_errored() const { return m_dom.is_errored(); }
+        };
+
+        /**
+         * @brief Serialize a payload with the given encoding, appending to out
+         *
+         * Lets callers reuse a buffer they already own instead of receiving a
+         * fresh string per message. MessagePack and CBOR are written straight
+         * into it, JSON is appended from dump().
+         */
+        inline void encode_into(const nlohmann::json &payload, Encoding encoding, std::string &out)
+        {
+            switch (encoding)
+            {
+            case Encoding::msgpack:
+                nlohmann::json::to_msgpack(payload, out);
+                break;
+            case Encoding::cbor:
+                nlohmann::json::to_cbor(payload, out);
+                break;
+            default:
+                /* Invalid UTF-8 is replaced, never thrown */
+                out.append(payload.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace));
+                break;
+            }
+        }
+
+        /**
+         * @brief Serialize a payload with the given encoding
+         *
+         * JSON yields text, MessagePack and CBOR yield binary frame payloads.
+         */
+        inline std::string encode(const nlohmann::json &payload, Encoding encoding)
+        {
+            std::string result;
+            encode_into(payload, encoding, result);
+            return result;
+        }
+
+        /**
+         * @brief Parse a frame payload with the given encoding
+         *
+         * Binary payloads are held to the same UTF-8 rules as JSON text, so
+         * whatever parses can be re-encoded for any peer, and to max_depth.
+         *
+         * @return A discarded value if the payload is not valid
+         */
+        inline nlohmann::json parse(const std::string &payload, Encoding encoding)
+        {
+            try
+            {
+                nlohmann::json::input_format_t format = nlohmann::json::input_format_t::json;
+
+                switch (encoding)
+                {
+                case Encoding::msgpack:
+                    format = nlohmann::json::input_format_t::msgpack;
+                    break;
+                case Encoding::cbor:
+                    format = nlohmann::json::input_format_t::cbor;
+                    break;
+                default:
+                    return nlohmann::json::parse(payload, nullptr, false);
+                }
+
+                nlohmann::json value;
+                BoundedSax sax(value);
+
+                if (!nlohmann::json::sax_parse(payload, &sax, format) || sax.is_errored() || !valid_strings(value))
+                    return nlohmann::json(nlohmann::json::value_t::discarded);
+
+                return value;
+            }
+            catch (const std::exception &e)
+            {
+                return nlohmann::json(nlohmann::json::value_t::discarded);
+            }
+        }
+
+    } // namespace Protocol
+
+} // namespace Horus
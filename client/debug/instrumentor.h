@@ -2,28 +2,104 @@
  * @file instrumentor.h
  * @brief Simple Instrumentor for Profiling
  *
- * This profiler will generate a json file that can be visualized with the chromium tracer
+ * This profiler will generate a json file that can be visualized with the chromium tracer,
+ * or the compact binary format of trace_format.h for paths not ending in .json
  */
 
 #pragma once
 
 #include <mutex>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <string>
 #include <thread>
+#include <random>
+#include <vector>
+#include <cstdint>
 #include <fstream>
 #include <algorithm>
+#include <condition_variable>
+
+#include "debug/trace_format.h"
 
 namespace Horus
 {
     namespace Debug
     {
 
+        /* Fixed size record, start and end are raw high_resolution_clock ticks, the ring knows the thread */
         struct ProfileResult
         {
-            const std::string name;
+            uint32_t name_id;
+            Trace::FlowPhase phase;
             long long start, end;
-            uint32_t thread_id;
+
+            /* Non zero for a flow hop, which only uses start */
+            uint64_t flow;
+        };
+
+        /* Single producer single consumer ring of one thread's results, drained by the flusher */
+        class ProfileBuffer
+        {
+        public:
+            static constexpr std::size_t capacity = 65536;
+
+        private:
+            std::array<ProfileResult, capacity> m_results;
+
+            alignas(64) std::atomic<std::size_t> m_head{0};
+            alignas(64) std::atomic<std::size_t> m_tail{0};
+
+            std::atomic<uint64_t> m_dropped{0};
+
+            /* Small sequential id of the owning thread */
+            const uint32_t m_thread_id;
+
+        public:
+            explicit ProfileBuffer(uint32_t thread_id)
+                : m_thread_id(thread_id)
+            {
+            }
+
+            uint32_t thread_id() const
+            {
+                return m_thread_id;
+            }
+
+            /* Producer side, never blocks, a full ring drops the result */
+            void push(const ProfileResult &result)
+            {
+                std::size_t head = m_head.load(std::memory_order_relaxed);
+
+                if (head - m_tail.load(std::memory_order_acquire) == capacity)
+                {
+                    m_dropped.store(m_dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    return;
+                }
+
+                m_results[head % capacity] = result;
+                m_head.store(head + 1, std::memory_order_release);
+            }
+
+            /* Consumer side */
+            template <typename Fn>
+            void drain(Fn &&fn)
+            {
+                std::size_t tail = m_tail.load(std::memory_order_relaxed);
+                std::size_t head = m_head.load(std::memory_order_acquire);
+
+                for (; tail != head; ++tail)
+                    fn(m_results[tail % capacity]);
+
+                m_tail.store(tail, std::memory_order_release);
+            }
+
+            uint64_t dropped() const
+            {
+                return m_dropped.load(std::memory_order_relaxed);
+            }
         };
 
         class Instrumentor
@@ -31,8 +107,32 @@ namespace Horus
             std::string m_session_name = "None";
             std::ofstream m_output_stream;
             int m_profile_count = 0;
+            uint64_t m_dropped_before = 0;
+            std::atomic<bool> m_active_session{false};
+
+            /* Runtime capture switch, results are only recorded while a session is active and capturing */
+            std::atomic<bool> m_capturing{false};
+
+            /* Output Format [binary records go through the encoder, names are written once per file] */
+            Trace::Format m_format = Trace::Format::json;
+            Trace::Encoder m_encoder;
+            std::size_t m_names_written = 0;
+
+            /* Rings of every thread that ever profiled, guarded by m_lock */
             std::mutex m_lock;
-            bool m_active_session = false;
+            std::vector<std::shared_ptr<ProfileBuffer>> m_buffers;
+
+            /* Scope names by id, interned once per call site and escaped for JSON on the way in */
+            std::mutex m_names_lock;
+            std::vector<std::string> m_names;
+
+            /* Background flusher, the only writer of the output stream while a session is active */
+            std::mutex m_flush_lock;
+            std::condition_variable m_flush_signal;
+            std::thread m_flusher;
+            bool m_flushing = false;
+
+            static constexpr std::chrono::milliseconds m_flush_interval{10};
 
             Instrumentor() {}
 
@@ -48,76 +148,255 @@ namespace Horus
                 end_session();
             }
 
-            void begin_session(const std::string &name, const std::string &file_path = "results.json")
+            void begin_session(const std::string &name, const std::string &file_path = "results.json", bool capture = true)
             {
                 if (m_active_session)
                 {
                     end_session();
                 }
-                m_active_session = true;
-                m_output_stream.open(file_path);
+                m_format = Trace::format_of(file_path);
+                m_output_stream.open(file_path, m_format == Trace::Format::binary ? std::ios::out | std::ios::binary : std::ios::out);
                 write_header();
                 m_session_name = name;
+                m_dropped_before = dropped();
+
+                {
+                    std::lock_guard<std::mutex> lock(m_flush_lock);
+                    m_flushing = true;
+                }
+
+                m_flusher = std::thread(&Instrumentor::flush_loop, this);
+                m_active_session = true;
+                m_capturing = capture;
             }
 
             void end_session()
             {
-                if (!m_active_session)
+                if (!m_active_session.exchange(false))
                 {
                     return;
                 }
-                m_active_session = false;
+
+                m_capturing = false;
+
+                {
+                    std::lock_guard<std::mutex> lock(m_flush_lock);
+                    m_flushing = false;
+                }
+
+                m_flush_signal.notify_one();
+                m_flusher.join();
+
+                /* Whatever was recorded after the last pass */
+                flush();
+
                 write_footer();
                 m_output_stream.close();
                 m_profile_count = 0;
+                m_names_written = 0;
+                m_encoder.reset();
             }
 
-            void write_profile(const ProfileResult &result)
+            /* Start or stop recording without closing the session */
+            void set_capturing(bool capturing)
             {
-                std::lock_guard<std::mutex> lock(m_lock);
+                m_capturing = capturing && m_active_session;
+            }
 
-                if (m_profile_count++ > 0)
+            bool capturing() const
+            {
+                return m_capturing.load(std::memory_order_relaxed);
+            }
+
+            /* Id of a scope name, call sites keep it in a static so this runs once each */
+            uint32_t intern(const char *name)
+            {
+                std::string escaped = name;
+                std::replace(escaped.begin(), escaped.end(), '"', '\'');
+
+                std::lock_guard<std::mutex> lock(m_names_lock);
+
+                auto it = std::find(m_names.begin(), m_names.end(), escaped);
+
+                if (it != m_names.end())
+                    return static_cast<uint32_t>(it - m_names.begin());
+
+                m_names.push_back(std::move(escaped));
+                return static_cast<uint32_t>(m_names.size() - 1);
+            }
+
+            /* Id for a message leaving this process, zero while not capturing so untraced messages carry nothing */
+            uint64_t new_flow_id()
+            {
+                if (!capturing())
                 {
-                    m_output_stream << ",";
+                    return 0;
                 }
 
-                std::string name = result.name;
-                std::replace(name.begin(), name.end(), '"', '\'');
+                /* A random process tag above a counter, distinct across processes and below 2^53 */
+                static const uint64_t tag = (std::random_device{}() & 0x1fffff) | 1;
+                static std::atomic<uint32_t> counter{0};
+
+                return tag << 32 | ++counter;
+            }
+
+            void write_flow(uint32_t name_id, Trace::FlowPhase phase, uint64_t id)
+            {
+                long long now = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+                write_profile(ProfileResult{name_id, phase, now, now, id});
+            }
+
+            void write_profile(const ProfileResult &result)
+            {
+                if (!m_capturing.load(std::memory_order_relaxed))
+                {
+                    return;
+                }
 
-                m_output_stream << "{";
-                m_output_stream << "\"cat\":\"function\",";
-                m_output_stream << "\"dur\":" << (result.end - result.start) << ',';
-                m_output_stream << "\"name\":\"" << name << "\",";
-                m_output_stream << "\"ph\":\"X\",";
-                m_output_stream << "\"pid\":0,";
-                m_output_stream << "\"tid\":" << result.thread_id << ",";
-                m_output_stream << "\"ts\":" << result.start;
-                m_output_stream << "}";
+                local_buffer().push(result);
             }
 
             void write_header()
             {
-                m_output_stream << "{\"otherData\": {},\"traceEvents\":[";
+                if (m_format == Trace::Format::json)
+                {
+                    Trace::write_json_header(m_output_stream);
+                    return;
+                }
+
+                m_encoder.header();
+                m_encoder.flush(m_output_stream);
             }
 
             void write_footer()
             {
-                m_output_stream << "]}";
+                /* Results lost to full rings */
+                uint64_t lost = dropped() - m_dropped_before;
+
+                if (m_format == Trace::Format::json)
+                {
+                    Trace::write_json_footer(m_output_stream, lost);
+                    return;
+                }
+
+                m_encoder.dropped(lost);
+                m_encoder.flush(m_output_stream);
+            }
+
+            uint64_t dropped()
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+
+                uint64_t result = 0;
+                for (const std::shared_ptr<ProfileBuffer> &buffer : m_buffers)
+                    result += buffer->dropped();
+
+                return result;
+            }
+
+        private:
+            /* Ring of the calling thread, registered on its first result and kept until the process ends */
+            ProfileBuffer &local_buffer()
+            {
+                static thread_local std::shared_ptr<ProfileBuffer> buffer;
+
+                if (!buffer)
+                {
+                    std::lock_guard<std::mutex> lock(m_lock);
+
+                    buffer = std::make_shared<ProfileBuffer>(static_cast<uint32_t>(m_buffers.size()));
+                    m_buffers.push_back(buffer);
+                }
+
+                return *buffer;
+            }
+
+            void flush_loop()
+            {
+                std::unique_lock<std::mutex> lock(m_flush_lock);
+
+                while (m_flushing)
+                {
+                    m_flush_signal.wait_for(lock, m_flush_interval);
+
+                    lock.unlock();
+                    flush();
+                    lock.lock();
+                }
+            }
+
+            /* Drain every ring into the output stream */
+            void flush()
+            {
+                std::vector<std::shared_ptr<ProfileBuffer>> buffers;
+
+                {
+                    std::lock_guard<std::mutex> lock(m_lock);
+                    buffers = m_buffers;
+                }
+
+                std::lock_guard<std::mutex> lock(m_names_lock);
+
+                /* Names interned since the last pass go out before the events using them */
+                if (m_format == Trace::Format::binary)
+                {
+                    for (; m_names_written < m_names.size(); ++m_names_written)
+                        m_encoder.name(static_cast<uint32_t>(m_names_written), m_names[m_names_written]);
+                }
+
+                for (const std::shared_ptr<ProfileBuffer> &buffer : buffers)
+                    buffer->drain([this, &buffer](const ProfileResult &result) { write_result(buffer->thread_id(), result); });
+
+                if (m_format == Trace::Format::binary)
+                    m_encoder.flush(m_output_stream);
+
+                m_output_stream.flush();
+            }
+
+            void write_result(uint32_t thread_id, const ProfileResult &result)
+            {
+                if (m_format == Trace::Format::binary)
+                {
+                    if (result.flow)
+                        m_encoder.flow(thread_id, result.name_id, result.phase, nanoseconds(result.start), result.flow);
+                    else
+                        m_encoder.event(thread_id, result.name_id, nanoseconds(result.start), nanoseconds(result.end));
+                    return;
+                }
+
+                if (m_profile_count++ > 0)
+                {
+                    m_output_stream << ",";
+                }
+
+                long long start = nanoseconds(result.start) / 1000;
+
+                if (result.flow)
+                {
+                    Trace::write_json_flow(m_output_stream, m_names[result.name_id], result.phase, result.flow, 0, thread_id, start);
+                    return;
+                }
+
+                Trace::write_json_event(m_output_stream, m_names[result.name_id], thread_id, start, nanoseconds(result.end) / 1000 - start);
+            }
+
+            static long long nanoseconds(long long ticks)
+            {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::duration(ticks)).count();
             }
         };
 
+        /* Two clock reads and a ring push per scope, the name travels as an interned id */
         class InstrumentationTimer
         {
             ProfileResult m_result;
-
-            std::chrono::time_point<std::chrono::high_resolution_clock> m_start_time_point;
             bool m_stopped;
 
         public:
-            InstrumentationTimer(const std::string &name)
-                : m_result({name, 0, 0, 0}), m_stopped(false)
+            explicit InstrumentationTimer(uint32_t name_id)
+                : m_result({name_id, Trace::FlowPhase::start, 0, 0, 0}), m_stopped(false)
             {
-                m_start_time_point = std::chrono::high_resolution_clock::now();
+                m_result.start = std::chrono::high_resolution_clock::now().time_since_epoch().count();
             }
 
             ~InstrumentationTimer()
@@ -130,11 +409,7 @@ namespace Horus
 
             void stop()
             {
-                auto end_time_point = std::chrono::high_resolution_clock::now();
-
-                m_result.start = std::chrono::time_point_cast<std::chrono::microseconds>(m_start_time_point).time_since_epoch().count();
-                m_result.end = std::chrono::time_point_cast<std::chrono::microseconds>(end_time_point).time_since_epoch().count();
-                m_result.thread_id = std::hash<std::thread::id>{}(std::this_thread::get_id());
+                m_result.end = std::chrono::high_resolution_clock::now().time_since_epoch().count();
                 Instrumentor::Instance().write_profile(m_result);
 
                 m_stopped = true;
@@ -168,12 +443,34 @@ namespace Horus
 /* Profile Macros */
 #define H_PROFILE_BEGIN_SESSION(name, file_path) ::Horus::Debug::Instrumentor::Instance().begin_session(name, file_path)
 #define H_PROFILE_END_SESSION() ::Horus::Debug::Instrumentor::Instance().end_session()
-#define H_PROFILE_SCOPE_LINE(name, line) ::Horus::Debug::InstrumentationTimer timer_line_##line(name)
+#define H_PROFILE_CAPTURE(enabled) ::Horus::Debug::Instrumentor::Instance().set_capturing(enabled)
+#define H_PROFILE_FLOW_ID() ::Horus::Debug::Instrumentor::Instance().new_flow_id()
+#define H_PROFILE_FLOW(name, phase, id)                                                                         \
+    do                                                                                                          \
+    {                                                                                                           \
+        uint64_t profile_flow_id = (id);                                                                        \
+        if (profile_flow_id)                                                                                    \
+        {                                                                                                       \
+            static const uint32_t profile_flow_name = ::Horus::Debug::Instrumentor::Instance().intern(name);    \
+            ::Horus::Debug::Instrumentor::Instance().write_flow(profile_flow_name, phase, profile_flow_id);     \
+        }                                                                                                       \
+    } while (0)
+#define H_PROFILE_FLOW_START(name, id) H_PROFILE_FLOW(name, ::Horus::Debug::Trace::FlowPhase::start, id)
+#define H_PROFILE_FLOW_STEP(name, id) H_PROFILE_FLOW(name, ::Horus::Debug::Trace::FlowPhase::step, id)
+#define H_PROFILE_FLOW_END(name, id) H_PROFILE_FLOW(name, ::Horus::Debug::Trace::FlowPhase::end, id)
+#define H_PROFILE_SCOPE_LINE(name, line)                                                                  \
+    static const uint32_t profile_id_line_##line = ::Horus::Debug::Instrumentor::Instance().intern(name); \
+    ::Horus::Debug::InstrumentationTimer timer_line_##line(profile_id_line_##line)
 #define H_PROFILE_SCOPE(name) H_PROFILE_SCOPE_LINE(name, __LINE__)
 #define H_PROFILE_FUNCTION() H_PROFILE_SCOPE(H_FUNC_SIG)
 #else
 #define H_PROFILE_BEGIN_SESSION(name, file_path)
 #define H_PROFILE_END_SESSION()
+#define H_PROFILE_CAPTURE(enabled)
+#define H_PROFILE_FLOW_ID() uint64_t(0)
+#define H_PROFILE_FLOW_START(name, id)
+#define H_PROFILE_FLOW_STEP(name, id)
+#define H_PROFILE_FLOW_END(name, id)
 #define H_PROFILE_SCOPE_LINE(name, line)
 #define H_PROFILE_SCOPE(name)
 #define H_PROFILE_FUNCTION()
@@ -0,0 +1,396 @@
+/**
+ * @file trace_format.h
+ * @brief Compact Binary Trace Format
+ *
+ * A trace file is the magic "HTRC", a version byte and a stream of records,
+ * each a kind byte followed by LEB128 varints:
+ *
+ *   name    [id, length, bytes]            scope name, precedes its first event
+ *   event   [thread, name, start, dur]     start is the zigzag delta from the
+ *                                          previous start of the same thread [ns]
+ *   flow    [thread, name, phase, start, id]  one hop of a message crossing
+ *                                          processes, start encoded as above
+ *   dropped [count]                        results lost to full rings
+ *
+ * Thread ids are small sequential numbers, so a typical event takes 6 to 8
+ * bytes instead of the ~100 of a Chrome trace JSON event.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+
+namespace Horus
+{
+    namespace Debug
+    {
+        namespace Trace
+        {
+            constexpr char magic[4] = {'H', 'T', 'R', 'C'};
+            constexpr uint8_t version = 2;
+
+            /* Decoder bounds [ids index tables sized by them, lengths size an allocation] */
+            constexpr uint64_t max_threads = 1 << 16;
+            constexpr uint64_t max_names = 1 << 20;
+            constexpr uint64_t max_name_length = 1 << 16;
+
+            enum class Record : uint8_t
+            {
+                name = 1,
+                event = 2,
+                dropped = 3,
+                flow = 4
+            };
+
+            /* Hop of a flow [Chrome ph s, t and f] */
+            enum class FlowPhase : uint8_t
+            {
+                start,
+                step,
+                end
+            };
+
+            inline char flow_phase_code(FlowPhase phase)
+            {
+                switch (phase)
+                {
+                case FlowPhase::start:
+                    return 's';
+                case FlowPhase::step:
+                    return 't';
+                default:
+                    return 'f';
+                }
+            }
+
+            enum class Format : uint8_t
+            {
+                json,
+                binary
+            };
+
+            /* Chrome JSON for paths ending in .json, the binary format otherwise */
+            inline Format format_of(const std::string &file_path)
+            {
+                const std::string extension = ".json";
+
+                if (file_path.size() >= extension.size() && file_path.compare(file_path.size() - extension.size(), extension.size(), extension) == 0)
+                    return Format::json;
+
+                return Format::binary;
+            }
+
+            /* Chrome Trace JSON [shared by the instrumentor and the converter] */
+            inline void write_json_header(std::ostream &out)
+            {
+                out << "{\"otherData\": {},\"traceEvents\":[";
+            }
+
+            inline void write_json_event(std::ostream &out, const std::string &name, uint32_t thread, long long start_us, long long dur_us, uint32_t pid = 0)
+            {
+                out << "{";
+                out << "\"cat\":\"function\",";
+                out << "\"dur\":" << dur_us << ',';
+                out << "\"name\":\"" << name << "\",";
+                out << "\"ph\":\"X\",";
+                out << "\"pid\":" << pid << ",";
+                out << "\"tid\":" << thread << ",";
+                out << "\"ts\":" << start_us;
+                out << "}";
+            }
+
+            /* Flow hops bind to the slice enclosing them, ids are kept below 2^53 so JavaScript reads them exactly */
+            inline void write_json_flow(std::ostream &out, const std::string &name, FlowPhase phase, uint64_t id, uint32_t pid, uint32_t thread, long long ts_us)
+            {
+                out << "{";
+                out << "\"cat\":\"flow\",";
+                out << "\"id\":" << id << ',';
+                out << "\"name\":\"" << name << "\",";
+                out << "\"ph\":\"" << flow_phase_code(phase) << "\",";
+
+                if (phase == FlowPhase::end)
+                    out << "\"bp\":\"e\",";
+
+                out << "\"pid\":" << pid << ",";
+                out << "\"tid\":" << thread << ",";
+                out << "\"ts\":" << ts_us;
+                out << "}";
+            }
+
+            /* Label of a process in a merged trace */
+            inline void write_json_process_name(std::ostream &out, uint32_t pid, const std::string &name)
+            {
+                out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"args\":{\"name\":\"" << name << "\"}}";
+            }
+
+            /* Extra top level keys are kept as trace metadata */
+            inline void write_json_footer(std::ostream &out, uint64_t dropped)
+            {
+                out << "],\"droppedEvents\":" << dropped << "}";
+            }
+
+            inline void put_varint(std::string &out, uint64_t value)
+            {
+                while (value >= 0x80)
+                {
+                    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                    value >>= 7;
+                }
+
+                out.push_back(static_cast<char>(value));
+            }
+
+            inline bool get_varint(std::istream &in, uint64_t &value)
+            {
+                value = 0;
+
+                for (unsigned shift = 0; shift < 64; shift += 7)
+                {
+                    int byte = in.get();
+
+                    if (byte == std::char_traits<char>::eof())
+                        return false;
+
+                    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+                    if (!(byte & 0x80))
+                        return true;
+                }
+
+                return false;
+            }
+
+            inline uint64_t zigzag(int64_t value)
+            {
+                return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+            }
+
+            inline int64_t unzigzag(uint64_t value)
+            {
+                return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+            }
+
+            /**
+             * @brief Encodes records into a byte buffer
+             *
+             * Keeps the last start of every thread, records must reach it in
+             * the order each thread produced them.
+             */
+            class Encoder
+            {
+            private:
+                std::string m_buffer;
+                std::vector<int64_t> m_last_start;
+
+            public:
+                void header()
+                {
+                    m_buffer.append(magic, sizeof(magic));
+                    m_buffer.push_back(static_cast<char>(version));
+                }
+
+                void name(uint32_t id, const std::string &text)
+                {
+                    m_buffer.push_back(static_cast<char>(Record::name));
+                    put_varint(m_buffer, id);
+                    put_varint(m_buffer, text.size());
+                    m_buffer.append(text);
+                }
+
+                void event(uint32_t thread, uint32_t name, int64_t start_ns, int64_t end_ns)
+                {
+                    if (thread >= m_last_start.size())
+                        m_last_start.resize(thread + 1, 0);
+
+                    m_buffer.push_back(static_cast<char>(Record::event));
+                    put_varint(m_buffer, thread);
+                    put_varint(m_buffer, name);
+                    put_varint(m_buffer, zigzag(start_ns - m_last_start[thread]));
+                    put_varint(m_buffer, static_cast<uint64_t>(end_ns > start_ns ? end_ns - start_ns : 0));
+
+                    m_last_start[thread] = start_ns;
+                }
+
+                void flow(uint32_t thread, uint32_t name, FlowPhase phase, int64_t ts_ns, uint64_t id)
+                {
+                    if (thread >= m_last_start.size())
+                        m_last_start.resize(thread + 1, 0);
+
+                    m_buffer.push_back(static_cast<char>(Record::flow));
+                    put_varint(m_buffer, thread);
+                    put_varint(m_buffer, name);
+                    m_buffer.push_back(static_cast<char>(phase));
+                    put_varint(m_buffer, zigzag(ts_ns - m_last_start[thread]));
+                    put_varint(m_buffer, id);
+
+                    m_last_start[thread] = ts_ns;
+                }
+
+                void dropped(uint64_t count)
+                {
+                    m_buffer.push_back(static_cast<char>(Record::dropped));
+                    put_varint(m_buffer, count);
+                }
+
+                /* Hand the encoded bytes over and start an empty buffer, thread state is kept */
+                void flush(std::ostream &out)
+                {
+                    out.write(m_buffer.data(), static_cast<std::streamsize>(m_buffer.size()));
+                    m_buffer.clear();
+                }
+
+                /* Forget the thread state, for a new file */
+                void reset()
+                {
+                    m_buffer.clear();
+                    m_last_start.clear();
+                }
+            };
+
+            /**
+             * @brief Decoded event
+             *
+             */
+            struct Event
+            {
+                uint32_t thread = 0;
+                uint32_t name = 0;
+                int64_t start_ns = 0;
+                int64_t dur_ns = 0;
+            };
+
+            /**
+             * @brief Decoded flow hop
+             *
+             */
+            struct Flow
+            {
+                uint32_t thread = 0;
+                uint32_t name = 0;
+                FlowPhase phase = FlowPhase::start;
+                int64_t ts_ns = 0;
+                uint64_t id = 0;
+            };
+
+            /**
+             * @brief Streams a binary trace back into records
+             *
+             * Version 1 files, written before flows existed, decode as well.
+             * A flow record in one is rejected as malformed.
+             *
+             * @return false if the magic, the version or a record is malformed
+             *         [or carries a thread, name id or length past the bounds]
+             */
+            template <typename OnName, typename OnEvent, typename OnFlow, typename OnDropped>
+            bool decode(std::istream &in, OnName &&on_name, OnEvent &&on_event, OnFlow &&on_flow, OnDropped &&on_dropped)
+            {
+                char header[sizeof(magic) + 1];
+
+                if (!in.read(header, sizeof(header)) || std::string(header, sizeof(magic)) != std::string(magic, sizeof(magic)))
+                    return false;
+
+                uint8_t file_version = static_cast<uint8_t>(header[sizeof(magic)]);
+
+                if (file_version < 1 || file_version > version)
+                    return false;
+
+                std::vector<int64_t> last_start;
+
+                for (int kind = in.get(); kind != std::char_traits<char>::eof(); kind = in.get())
+                {
+                    switch (static_cast<Record>(kind))
+                    {
+                    case Record::name:
+                    {
+                        uint64_t id = 0, length = 0;
+
+                        if (!get_varint(in, id) || !get_varint(in, length) || id >= max_names || length > max_name_length)
+                            return false;
+
+                        std::string text(static_cast<std::size_t>(length), '\0');
+
+                        if (!in.read(&text[0], static_cast<std::streamsize>(length)))
+                            return false;
+
+                        on_name(static_cast<uint32_t>(id), text);
+                        break;
+                    }
+                    case Record::event:
+                    {
+                        uint64_t thread = 0, name = 0, delta = 0, duration = 0;
+
+                        if (!get_varint(in, thread) || !get_varint(in, name) || !get_varint(in, delta) || !get_varint(in, duration))
+                            return false;
+
+                        if (thread >= max_threads || name >= max_names)
+                            return false;
+
+                        if (thread >= last_start.size())
+                            last_start.resize(static_cast<std::size_t>(thread) + 1, 0);
+
+                        Event event;
+                        event.thread = static_cast<uint32_t>(thread);
+                        event.name = static_cast<uint32_t>(name);
+                        event.start_ns = last_start[event.thread] + unzigzag(delta);
+                        event.dur_ns = static_cast<int64_t>(duration);
+
+                        last_start[event.thread] = event.start_ns;
+                        on_event(event);
+                        break;
+                    }
+                    case Record::flow:
+                    {
+                        uint64_t thread = 0, name = 0, delta = 0, id = 0;
+                        int phase = 0;
+
+                        /* Flows came with version 2, the kind cannot appear in an older file */
+                        if (file_version < 2)
+                            return false;
+
+                        if (!get_varint(in, thread) || !get_varint(in, name) || (phase = in.get()) > static_cast<int>(FlowPhase::end) || phase < 0 || !get_varint(in, delta) || !get_varint(in, id))
+                            return false;
+
+                        if (thread >= max_threads || name >= max_names)
+                            return false;
+
+                        if (thread >= last_start.size())
+                            last_start.resize(static_cast<std::size_t>(thread) + 1, 0);
+
+                        Flow flow;
+                        flow.thread = static_cast<uint32_t>(thread);
+                        flow.name = static_cast<uint32_t>(name);
+                        flow.phase = static_cast<FlowPhase>(phase);
+                        flow.ts_ns = last_start[flow.thread] + unzigzag(delta);
+                        flow.id = id;
+
+                        last_start[flow.thread] = flow.ts_ns;
+                        on_flow(flow);
+                        break;
+                    }
+                    case Record::dropped:
+                    {
+                        uint64_t count = 0;
+
+                        if (!get_varint(in, count))
+                            return false;
+
+                        on_dropped(count);
+                        break;
+                    }
+                    default:
+                        return false;
+                    }
+                }
+
+                return true;
+            }
+
+        } // namespace Trace
+
+    } // namespace Debug
+
+} // namespace Horus
@@ -16,15 +16,25 @@ int main(int argc, char **argv)
     std::string host;
     uint16_t port = 9002;
     std::string name;
+    std::string encoding_name = "json";
+    uint32_t deflate_window_bits = 15;
+    bool deflate_no_context_takeover = false;
+    std::string trace_file = "client.trace";
 
     /* Set cli options */
     clipp::group cli(
         clipp::required("-h", "--host").doc("middleware host") & clipp::value("host", host),
         clipp::required("-p", "--port").doc("port to listen on") & clipp::value("port", port),
-        clipp::required("-n", "--name").doc("client name") & clipp::value("name", name));
+        clipp::required("-n", "--name").doc("client name") & clipp::value("name", name),
+        clipp::option("-e", "--encoding").doc("payload encoding [json|msgpack|cbor, default: json]") & clipp::value("encoding", encoding_name),
+        clipp::option("--deflate-window-bits").doc("permessage-deflate window bits [8-15, default: 15]") & clipp::value("bits", deflate_window_bits),
+        clipp::option("--deflate-no-context-takeover").set(deflate_no_context_takeover).doc("reset the compressor after every message"),
+        clipp::option("--trace-file").doc("profile output [.json for Chrome JSON, default: client.trace]") & clipp::value("path", trace_file));
 
     /* Parse the args */
-    if (!clipp::parse(argc, argv, cli))
+    Horus::Protocol::Encoding encoding = Horus::Protocol::Encoding::json;
+
+    if (!clipp::parse(argc, argv, cli) || !Horus::Protocol::encoding_from_string(encoding_name, encoding))
     {
         /* Show help */
         std::cout << clipp::make_man_page(cli, "client");
@@ -34,8 +44,12 @@ int main(int argc, char **argv)
         return 0;
     }
 
+    /* Compression Tunables [used when built with ENABLE_PERMESSAGE_DEFLATE] */
+    Horus::Deflate::settings().max_window_bits = Horus::Deflate::clamp_window_bits(deflate_window_bits);
+    Horus::Deflate::settings().no_context_takeover = deflate_no_context_takeover;
+
     /* Starts Profile Session */
-    H_PROFILE_BEGIN_SESSION("Application Profile", "profile_results.json");
+    H_PROFILE_BEGIN_SESSION("Application Profile", trace_file);
 
     {
         /* Profiles the Main Function */
@@ -48,7 +62,7 @@ int main(int argc, char **argv)
         Client client;
 
         /* Start client with given host:port */
-        client.run(host, port, name);
+        client.run(host, port, name, encoding);
 
         /* Interaction */
         bool done = false;
@@ -60,6 +74,10 @@ int main(int argc, char **argv)
         std::string help = "\n[command]    - [description]\n"
                            "name <text>  - update the name of a agent\n"
                            "state <0|1>  - update the state of a agent [ON|OFF]\n"
+                           "agents       - list the known agents\n"
+                           "sync         - fetch agent changes since the last known version\n"
+                           "subscribe    - only follow agents matching <guid|first-last|prefix>...\n"
+                           "trace on|off - start or stop trace capture [profiling builds]\n"
                            "quit         - close the connection and quit\n"
                            "help         - show this help message\n";
 
@@ -74,6 +92,68 @@ int main(int argc, char **argv)
                 done = true;
             else if (input == "help")
                 std::cout << help << std::endl;
+            else if (input == "agents")
+            {
+                std::cout << std::endl;
+
+                for (const Horus::Protocol::UpdateMessage &agent : client.agents())
+                    std::cout << "[" << agent.guid << "] " << agent.name << " status => [" << agent.status << "] state => [" << (agent.state ? "ON" : "OFF") << "] version => [" << agent.version << "]" << std::endl;
+
+                std::cout << std::endl;
+            }
+            else if (input == "sync")
+                client.sync();
+            else if (input == "subscribe" || input.rfind("subscribe ", 0) == 0)
+            {
+                Horus::Protocol::SubscribeMessage filter;
+                std::istringstream tokens(input.substr(9));
+                std::string token;
+                bool guids_valid = true;
+
+                /* Whole token as a guid, false if it does not fit 32 bits */
+                auto parse_guid = [](const std::string &text, uint32_t &guid) {
+                    std::from_chars_result result = std::from_chars(text.data(), text.data() + text.size(), guid);
+                    return result.ec == std::errc() && result.ptr == text.data() + text.size();
+                };
+
+                /* Digits are guids, digits-digits are ranges, anything else is a name prefix */
+                while (tokens >> token)
+                {
+                    std::size_t dash = token.find('-');
+                    bool numeric = token.find_first_not_of("0123456789-") == std::string::npos && dash != 0 && dash != token.size() - 1 && token.find('-', dash + 1) == std::string::npos;
+
+                    uint32_t first = 0, last = 0;
+
+                    if (numeric && dash == std::string::npos)
+                    {
+                        guids_valid &= parse_guid(token, first);
+                        filter.guids.push_back(first);
+                    }
+                    else if (numeric)
+                    {
+                        guids_valid &= parse_guid(token.substr(0, dash), first) && parse_guid(token.substr(dash + 1), last);
+                        filter.ranges.emplace_back(first, last);
+                    }
+                    else
+                        filter.prefixes.push_back(token);
+                }
+
+                if (!guids_valid)
+                {
+                    std::cout << "\n!> invalid guid\n"
+                              << std::endl;
+                    continue;
+                }
+
+                if (filter.ranges.end() != std::find_if(filter.ranges.begin(), filter.ranges.end(), [](const std::pair<uint32_t, uint32_t> &range) { return range.first > range.second; }))
+                {
+                    std::cout << "\n!> invalid range\n"
+                              << std::endl;
+                    continue;
+                }
+
+                client.subscribe(filter);
+            }
             else if (input.substr(0, 4) == "name")
             {
                 std::string new_name = input.substr(5);
@@ -108,6 +188,17 @@ int main(int argc, char **argv)
 
                 client.update_agent_state(new_state == '0' ? false : true, guid);
             }
+            else if (input == "trace on" || input == "trace off")
+            {
+#ifdef ENABLE_PROFILING
+                H_PROFILE_CAPTURE(input == "trace on");
+                std::cout << "\ntrace capture => [" << (::Horus::Debug::Instrumentor::Instance().capturing() ? "on" : "off") << "]\n"
+                          << std::endl;
+#else
+                std::cout << "\n!> built without profiling\n"
+                          << std::endl;
+#endif
+            }
             else
                 std::cout << "\n!> unrecognized command\ntype 'help' to see the commands list\n " << std::endl;
         }
@@ -7,17 +7,23 @@
 #pragma once
 
 /* StdLib Stuff */
+#include <map>
 #include <set>
+#include <deque>
 #include <regex>
 #include <mutex>
 #include <atomic>
 #include <string>
 #include <thread>
+#include <vector>
 #include <chrono>
+#include <charconv>
 #include <fstream>
+#include <sstream>
 #include <iostream>
 #include <algorithm>
 #include <filesystem>
+#include <unordered_map>
 #include <functional>
 #include <condition_variable>
 
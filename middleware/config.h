@@ -13,3 +13,6 @@
 
 /* Porject Version String [SEMVER] */
 #define PROJECT_VERSION "v1.0.0"
+
+/* Per Connection Read Buffer [bytes] */
+#define MIDDLEWARE_READ_BUFFER_SIZE 4096
@@ -0,0 +1,155 @@
+/**
+ * @file deflate.h
+ * @brief Opt-in permessage-deflate Endpoint Config
+ *
+ * Keep the copies under middleware/, agent/ and client/ identical.
+ */
+
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include <algorithm>
+
+namespace Horus
+{
+    namespace Deflate
+    {
+        /**
+         * @brief Compression tunables applied to every new connection
+         *
+         * Set them before the endpoint starts connecting, the extension of
+         * each connection reads them once when it is created. Both values
+         * apply to the direction this endpoint compresses and to the one it
+         * requests from the peer.
+         */
+        struct Settings
+        {
+            /* LZ77 window size [8 to 15 bits, smaller saves memory per connection] */
+            uint8_t max_window_bits = 15;
+
+            /* Reset the compressor after every message [no memory kept between messages, worse ratio] */
+            bool no_context_takeover = false;
+        };
+
+        inline Settings &settings()
+        {
+            static Settings instance;
+            return instance;
+        }
+
+        /**
+         * @brief Clamp a requested window size into the range permessage-deflate allows
+         *
+         */
+        inline uint8_t clamp_window_bits(uint32_t bits)
+        {
+            return static_cast<uint8_t>(std::min<uint32_t>(std::max<uint32_t>(bits, 8), 15));
+        }
+
+    } // namespace Deflate
+
+} // namespace Horus
+
+#ifdef ENABLE_PERMESSAGE_DEFLATE
+
+#include <websocketpp/config/asio_no_tls.hpp>
+#include <websocketpp/extensions/permessage_deflate/enabled.hpp>
+
+namespace Horus
+{
+    namespace Deflate
+    {
+        /**
+         * @brief permessage-deflate extension configured from Settings
+         *
+         * The processor default constructs one per connection, so the
+         * tunables are applied here instead of through the endpoint.
+         */
+        template <typename config>
+        class Extension : public websocketpp::extensions::permessage_deflate::enabled<config>
+        {
+        public:
+            Extension()
+            {
+                const Settings &current = settings();
+
+                if (current.max_window_bits < 15)
+                {
+                    this->set_s2c_max_window_bits(current.max_window_bits, websocketpp::extensions::permessage_deflate::mode::smallest);
+                    this->set_c2s_max_window_bits(current.max_window_bits, websocketpp::extensions::permessage_deflate::mode::smallest);
+                }
+
+                if (current.no_context_takeover)
+                {
+                    this->enable_s2c_no_context_takeover();
+                    this->enable_c2s_no_context_takeover();
+                }
+            }
+
+            /* Client offer built from the settings instead of the fixed upstream one */
+            std::string generate_offer() const
+            {
+                const Settings &current = settings();
+                std::string offer = "permessage-deflate; client_max_window_bits";
+
+                if (current.max_window_bits < 15)
+                {
+                    offer += "=" + std::to_string(current.max_window_bits);
+                    offer += "; server_max_window_bits=" + std::to_string(current.max_window_bits);
+                }
+
+                if (current.no_context_takeover)
+                    offer += "; client_no_context_takeover; server_no_context_takeover";
+
+                return offer;
+            }
+        };
+
+        /**
+         * @brief websocketpp::config::asio with permessage-deflate enabled
+         *
+         */
+        struct Config : public websocketpp::config::asio
+        {
+            typedef Config type;
+            typedef websocketpp::config::asio base;
+
+            typedef base::concurrency_type concurrency_type;
+
+            typedef base::request_type request_type;
+            typedef base::response_type response_type;
+
+            typedef base::message_type message_type;
+            typedef base::con_msg_manager_type con_msg_manager_type;
+            typedef base::endpoint_msg_manager_type endpoint_msg_manager_type;
+
+            typedef base::alog_type alog_type;
+            typedef base::elog_type elog_type;
+
+            typedef base::rng_type rng_type;
+
+            struct transport_config : public base::transport_config
+            {
+                typedef type::concurrency_type concurrency_type;
+                typedef type::alog_type alog_type;
+                typedef type::elog_type elog_type;
+                typedef type::request_type request_type;
+                typedef type::response_type response_type;
+                typedef websocketpp::transport::asio::basic_socket::endpoint socket_type;
+            };
+
+            typedef websocketpp::transport::asio::endpoint<transport_config> transport_type;
+
+            struct permessage_deflate_config
+            {
+            };
+
+            typedef Extension<permessage_deflate_config> permessage_deflate_type;
+        };
+
+    } // namespace Deflate
+
+} // namespace Horus
+
+#endif
@@ -0,0 +1,295 @@
+/**
+ * @file histogram.h
+ * @brief Always On Latency Histograms
+ *
+ */
+
+#pragma once
+
+#include <mutex>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+
+namespace Horus
+{
+    /**
+     * @brief Log linear histogram of nanosecond samples
+     *
+     * Same bucketing as HdrHistogram: values below 32 get a bucket each,
+     * every power of two above is split into 32 sub buckets, so a
+     * reported value is never more than 1/32 above the recorded one.
+     * Values from 2^36 ns [~68 s] on share the last bucket.
+     */
+    class Histogram
+    {
+    public:
+        static constexpr unsigned sub_bucket_bits = 5;
+        static constexpr uint64_t sub_bucket_count = uint64_t(1) << sub_bucket_bits;
+        static constexpr unsigned max_magnitude = 36;
+        static constexpr std::size_t bucket_count = sub_bucket_count + (max_magnitude - sub_bucket_bits) * sub_bucket_count;
+
+    private:
+        std::array<uint64_t, bucket_count> m_counts{};
+        uint64_t m_count = 0;
+        uint64_t m_sum = 0;
+        uint64_t m_max = 0;
+
+    public:
+        /**
+         * @brief Bucket a value falls in
+         *
+         */
+        static std::size_t index_of(uint64_t value)
+        {
+            if (value < sub_bucket_count)
+                return static_cast<std::size_t>(value);
+
+            if (value >> max_magnitude)
+                return bucket_count - 1;
+
+            unsigned magnitude = magnitude_of(value);
+            unsigned shift = magnitude - sub_bucket_bits;
+
+            return static_cast<std::size_t>(sub_bucket_count + shift * sub_bucket_count + ((value >> shift) - sub_bucket_count));
+        }
+
+        /**
+         * @brief Highest value that lands in a bucket
+         *
+         */
+        static uint64_t value_at(std::size_t index)
+        {
+            if (index < sub_bucket_count)
+                return index;
+
+            unsigned shift = static_cast<unsigned>((index - sub_bucket_count) / sub_bucket_count);
+            uint64_t mantissa = (index - sub_bucket_count) % sub_bucket_count + sub_bucket_count;
+
+            return ((mantissa + 1) << shift) - 1;
+        }
+
+        void record(uint64_t value)
+        {
+            m_counts[index_of(value)]++;
+            m_count++;
+            m_sum += value;
+            m_max = value > m_max ? value : m_max;
+        }
+
+        /**
+         * @brief Add the samples of a single bucket [used when merging per thread counters]
+         *
+         */
+        void add(std::size_t index, uint64_t count)
+        {
+            m_counts[index] += count;
+            m_count += count;
+        }
+
+        void add_totals(uint64_t sum, uint64_t max)
+        {
+            m_sum += sum;
+            m_max = max > m_max ? max : m_max;
+        }
+
+        void merge(const Histogram &other)
+        {
+            for (std::size_t index = 0; index < bucket_count; ++index)
+                m_counts[index] += other.m_counts[index];
+
+            m_count += other.m_count;
+            add_totals(other.m_sum, other.m_max);
+        }
+
+        /**
+         * @brief Value below which a share of the samples fall
+         *
+         * @param percentile Share in percent, 99.9 for the p999
+         * @return zero when empty, never above the largest sample
+         */
+        uint64_t percentile(double percentile) const
+        {
+            if (m_count == 0)
+                return 0;
+
+            uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * static_cast<double>(m_count) + 0.5);
+            rank = rank < 1 ? 1 : (rank > m_count ? m_count : rank);
+
+            uint64_t seen = 0;
+
+            for (std::size_t index = 0; index < bucket_count; ++index)
+            {
+                seen += m_counts[index];
+
+                if (seen >= rank)
+                    return value_at(index) < m_max ? value_at(index) : m_max;
+            }
+
+            return m_max;
+        }
+
+        uint64_t count() const { return m_count; }
+        uint64_t sum() const { return m_sum; }
+        uint64_t max() const { return m_max; }
+        uint64_t mean() const { return m_count ? m_sum / m_count : 0; }
+
+    private:
+        /* Index of the highest set bit */
+        static unsigned magnitude_of(uint64_t value)
+        {
+            unsigned magnitude = 0;
+
+            for (unsigned step = 32; step > 0; step >>= 1)
+            {
+                if (value >> step)
+                {
+                    value >>= step;
+                    magnitude += step;
+                }
+            }
+
+            return magnitude;
+        }
+    };
+
+    /**
+     * @brief Fixed set of histograms recorded from many threads
+     *
+     * Every recording thread gets its own buckets on first use, so a
+     * sample is one uncontended relaxed store on memory no other thread
+     * writes. Readers merge the threads into plain Histograms and never
+     * block the recorders.
+     *
+     * @tparam Series Number of histograms in the set
+     */
+    template <std::size_t Series>
+    class HistogramSet
+    {
+    private:
+        struct Buckets
+        {
+            std::array<std::array<std::atomic<uint64_t>, Histogram::bucket_count>, Series> counts{};
+            std::array<std::atomic<uint64_t>, Series> sums{};
+            std::array<std::atomic<uint64_t>, Series> maxes{};
+        };
+
+        /* Buckets of the set the calling thread used last */
+        struct Cache
+        {
+            uint64_t owner = 0;
+            Buckets *buckets = nullptr;
+        };
+
+        static uint64_t next_id()
+        {
+            static std::atomic<uint64_t> ids{0};
+            return ++ids;
+        }
+
+        /* Unique per set, so a thread never follows a cache entry into a destroyed set at the same address */
+        const uint64_t m_id = next_id();
+
+        mutable std::mutex m_lock;
+        std::vector<std::pair<std::thread::id, std::unique_ptr<Buckets>>> m_threads;
+
+    public:
+        static constexpr std::size_t series = Series;
+
+        HistogramSet() = default;
+        HistogramSet(const HistogramSet &) = delete;
+        HistogramSet &operator=(const HistogramSet &) = delete;
+
+        /**
+         * @brief Record a sample into one series
+         *
+         * @param index Series index, below Series
+         * @param value Sample [ns]
+         */
+        void record(std::size_t index, uint64_t value)
+        {
+            Buckets &buckets = local();
+
+            /* Only this thread writes its buckets, a load and store is enough */
+            std::atomic<uint64_t> &count = buckets.counts[index][Histogram::index_of(value)];
+            count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+            std::atomic<uint64_t> &sum = buckets.sums[index];
+            sum.store(sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+
+            std::atomic<uint64_t> &max = buckets.maxes[index];
+            if (value > max.load(std::memory_order_relaxed))
+                max.store(value, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Merge every thread into one histogram
+         *
+         */
+        Histogram snapshot(std::size_t index) const
+        {
+            Histogram histogram;
+
+            std::lock_guard<std::mutex> lock(m_lock);
+
+            for (const auto &thread : m_threads)
+            {
+                const Buckets &buckets = *thread.second;
+
+                for (std::size_t bucket = 0; bucket < Histogram::bucket_count; ++bucket)
+                {
+                    uint64_t count = buckets.counts[index][bucket].load(std::memory_order_relaxed);
+
+                    if (count)
+                        histogram.add(bucket, count);
+                }
+
+                histogram.add_totals(buckets.sums[index].load(std::memory_order_relaxed), buckets.maxes[index].load(std::memory_order_relaxed));
+            }
+
+            return histogram;
+        }
+
+        /**
+         * @brief Threads that recorded at least one sample
+         *
+         */
+        std::size_t threads() const
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            return m_threads.size();
+        }
+
+    private:
+        Buckets &local()
+        {
+            static thread_local Cache cache;
+
+            if (cache.owner != m_id)
+                cache = Cache{m_id, &attach()};
+
+            return *cache.buckets;
+        }
+
+        /* Buckets of the calling thread, created on its first sample */
+        Buckets &attach()
+        {
+            std::thread::id self = std::this_thread::get_id();
+
+            std::lock_guard<std::mutex> lock(m_lock);
+
+            for (auto &thread : m_threads)
+                if (thread.first == self)
+                    return *thread.second;
+
+            m_threads.emplace_back(self, std::unique_ptr<Buckets>(new Buckets()));
+            return *m_threads.back().second;
+        }
+    };
+
+} // namespace Horus
@@ -0,0 +1,157 @@
+/**
+ * @file message_pool.h
+ * @brief Recycled websocketpp Message Buffers
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstddef>
+
+#include <websocketpp/frame.hpp>
+#include <websocketpp/message_buffer/message.hpp>
+#include <websocketpp/message_buffer/alloc.hpp>
+
+#include "core/pool.h"
+
+namespace Horus
+{
+    namespace Pool
+    {
+        /**
+         * @brief Limits of the message pool
+         *
+         * Read when the pool is first used, set them before the endpoint
+         * starts.
+         */
+        struct Settings
+        {
+            /* Bytes retained by the messages kept for reuse [object and payload capacity] */
+            std::size_t max_bytes = 16 * 1024 * 1024;
+
+            /* Bytes a thread keeps to itself before handing the rest to the other threads */
+            std::size_t max_thread_bytes = 1024 * 1024;
+
+            /* Payload capacity above which a message is freed instead of kept [bytes] */
+            std::size_t max_capacity = 64 * 1024;
+        };
+
+        inline Settings &settings()
+        {
+            static Settings instance;
+            return instance;
+        }
+
+        /**
+         * @brief websocketpp con_msg_manager backed by a process wide pool
+         *
+         * Every message, read or written by any connection, comes from the
+         * same pool and goes back to it once the last reference drops, into
+         * the free list of the releasing thread. The payload keeps its
+         * capacity, so steady traffic stops allocating.
+         *
+         * @tparam message websocketpp message type
+         */
+        template <typename message>
+        class MessageManager : public websocketpp::lib::enable_shared_from_this<MessageManager<message>>
+        {
+        public:
+            typedef MessageManager<message> type;
+            typedef websocketpp::lib::shared_ptr<MessageManager> ptr;
+            typedef websocketpp::lib::weak_ptr<MessageManager> weak_ptr;
+            typedef typename message::ptr message_ptr;
+
+            message_ptr get_message()
+            {
+                return acquire(websocketpp::frame::opcode::text, 0);
+            }
+
+            message_ptr get_message(websocketpp::frame::opcode::value op, std::size_t size)
+            {
+                return acquire(op, size);
+            }
+
+            /* Messages return to the pool through their deleter */
+            bool recycle(message *)
+            {
+                return false;
+            }
+
+            /**
+             * @brief Take a clean message with at least size bytes of payload capacity
+             *
+             */
+            static message_ptr acquire(websocketpp::frame::opcode::value op, std::size_t size)
+            {
+                std::unique_ptr<message> msg = pool().take();
+
+                if (msg)
+                {
+                    msg->set_opcode(op);
+                    msg->get_raw_payload().reserve(size);
+                }
+                else
+                {
+                    /* Pooled messages outlive any connection, they hold no manager */
+                    msg.reset(new message(ptr(), op, size));
+                    pool().allocated();
+                }
+
+                return message_ptr(msg.release(), &release);
+            }
+
+            static PoolStats stats()
+            {
+                return pool().stats();
+            }
+
+        private:
+            /* Never destroyed, messages may still be released during static destruction */
+            static ObjectPool<message> &pool()
+            {
+                static ObjectPool<message> *instance = new ObjectPool<message>(settings().max_bytes, settings().max_thread_bytes);
+                return *instance;
+            }
+
+            static void release(message *msg)
+            {
+                std::unique_ptr<message> owned(msg);
+
+                if (owned->get_raw_payload().capacity() > settings().max_capacity)
+                {
+                    pool().discarded();
+                    return;
+                }
+
+                owned->get_raw_payload().clear();
+                owned->set_header(std::string());
+                owned->set_prepared(false);
+                owned->set_compressed(false);
+                owned->set_fin(true);
+                owned->set_terminal(false);
+
+                std::size_t bytes = sizeof(message) + owned->get_raw_payload().capacity() + owned->get_header().capacity();
+                pool().give(std::move(owned), bytes);
+            }
+        };
+
+        /**
+         * @brief Endpoint config whose messages come from the pool
+         *
+         * @tparam base Config being extended
+         */
+        template <typename base>
+        struct Config : public base
+        {
+            typedef Config type;
+
+            typedef websocketpp::message_buffer::message<MessageManager> message_type;
+            typedef MessageManager<message_type> con_msg_manager_type;
+            typedef websocketpp::message_buffer::alloc::endpoint_msg_manager<con_msg_manager_type> endpoint_msg_manager_type;
+        };
+
+    } // namespace Pool
+
+} // namespace Horus
@@ -0,0 +1,551 @@
+/**
+ * @file metadata.h
+ * @brief Compact Connection Metadata Storage
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <string_view>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace Horus
+{
+    /**
+     * @brief Connection status as seen on the wire
+     *
+     */
+    enum class Status : uint8_t
+    {
+        open,
+        ready,
+        unknown
+    };
+
+    inline const char *to_string(Status status)
+    {
+        switch (status)
+        {
+        case Status::open:
+            return "open";
+        case Status::ready:
+            return "ready";
+        default:
+            return "unknown";
+        }
+    }
+
+    inline Status status_from_string(std::string_view status)
+    {
+        if (status == "open")
+            return Status::open;
+        if (status == "ready")
+            return Status::ready;
+        return Status::unknown;
+    }
+
+    /**
+     * @brief Reference counted string interning table
+     *
+     * Every distinct name is stored once and referred to by a 32 bit id.
+     * intern takes a reference and release drops it, a name nobody refers
+     * to is freed and its id handed to the next new name. Memory follows
+     * the names in use, not every name ever seen.
+     */
+    class NameTable
+    {
+    private:
+        mutable std::shared_mutex m_lock;
+        std::deque<std::string> m_names;
+        std::deque<std::atomic<uint32_t>> m_refs;
+        std::vector<uint32_t> m_free;
+        std::unordered_map<std::string_view, uint32_t> m_ids;
+
+    public:
+        /**
+         * @brief Get the id of a name and take a reference on it, registering it on first use
+         *
+         */
+        uint32_t intern(std::string_view name)
+        {
+            {
+                std::shared_lock<std::shared_mutex> lock(m_lock);
+                auto it = m_ids.find(name);
+                if (it != m_ids.end())
+                {
+                    m_refs[it->second].fetch_add(1, std::memory_order_relaxed);
+                    return it->second;
+                }
+            }
+
+            std::unique_lock<std::shared_mutex> lock(m_lock);
+
+            auto it = m_ids.find(name);
+            if (it != m_ids.end())
+            {
+                m_refs[it->second].fetch_add(1, std::memory_order_relaxed);
+                return it->second;
+            }
+
+            uint32_t id = static_cast<uint32_t>(m_names.size());
+
+            if (!m_free.empty())
+            {
+                id = m_free.back();
+                m_free.pop_back();
+                m_names[id] = name;
+                m_refs[id].store(1, std::memory_order_relaxed);
+            }
+            else
+            {
+                m_names.emplace_back(name);
+                m_refs.emplace_back(1);
+            }
+
+            m_ids.emplace(m_names[id], id);
+            return id;
+        }
+
+        /**
+         * @brief Drop a reference taken by intern, freeing the name with the last one
+         *
+         */
+        void release(uint32_t id)
+        {
+            {
+                std::shared_lock<std::shared_mutex> lock(m_lock);
+
+                if (id >= m_refs.size())
+                    return;
+
+                /* Only the last reference needs the exclusive lock */
+                uint32_t refs = m_refs[id].load(std::memory_order_relaxed);
+                while (refs > 1)
+                    if (m_refs[id].compare_exchange_weak(refs, refs - 1, std::memory_order_relaxed))
+                        return;
+            }
+
+            std::unique_lock<std::shared_mutex> lock(m_lock);
+
+            if (m_refs[id].load(std::memory_order_relaxed) == 0 || m_refs[id].fetch_sub(1, std::memory_order_relaxed) != 1)
+                return;
+
+            m_ids.erase(m_names[id]);
+            std::string().swap(m_names[id]);
+            m_free.push_back(id);
+        }
+
+        /**
+         * @brief Get the name behind an id
+         *
+         * The deque never moves its elements, the reference stays valid
+         * while the caller holds a reference on the id [a metadata row read
+         * under its shard lock does].
+         */
+        const std::string &name(uint32_t id) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_lock);
+            return m_names.at(id);
+        }
+
+        /**
+         * @brief Number of distinct names in use
+         *
+         */
+        std::size_t size() const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_lock);
+            return m_ids.size();
+        }
+
+        /**
+         * @brief Approximate heap bytes held by the table
+         *
+         */
+        std::size_t memory_usage() const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_lock);
+
+            std::size_t bytes = m_names.size() * (sizeof(std::string) + sizeof(std::atomic<uint32_t>));
+            for (const std::string &name : m_names)
+                if (name.capacity() > std::string().capacity())
+                    bytes += name.capacity() + 1;
+
+            bytes += m_free.capacity() * sizeof(uint32_t);
+
+            /* Bucket array plus one node per id */
+            bytes += m_ids.bucket_count() * sizeof(void *);
+            bytes += m_ids.size() * (sizeof(std::pair<const std::string_view, uint32_t>) + 2 * sizeof(void *));
+            return bytes;
+        }
+    };
+
+    /**
+     * @brief Which side of the middleware a guid belongs to
+     *
+     */
+    enum class Kind : uint8_t
+    {
+        client,
+        agent
+    };
+
+    /**
+     * @brief Generational slot map holding the metadata of every connection
+     *
+     * A guid packs a slot index in its low IndexBits and the generation of
+     * that slot in the remaining high bits. Each shard owns the slots
+     * congruent to its index, index / ShardCount is the row inside the
+     * shard. Freed rows wait in a FIFO queue and are only reused once more
+     * than reuse_depth of them are queued, with their generation bumped, so
+     * a guid kept past its erase no longer resolves. Generations start at 1
+     * [guid 0 is never handed out] and never wrap, a slot whose generation
+     * is saturated is retired instead of reused.
+     *
+     * A row costs one flags byte, one generation, one name id, one version
+     * and one handle, no per-guid heap allocation. Memory is bounded by the
+     * peak number of live connections plus reuse_depth rows per shard, and
+     * the retired slots [one per 2^(32 - IndexBits) - 1 erases of a slot].
+     *
+     * @tparam Handle Connection handle type
+     * @tparam ShardCount Number of independently locked shards
+     * @tparam IndexBits Guid bits addressing a slot
+     */
+    template <typename Handle, std::size_t ShardCount = 16, unsigned IndexBits = 22>
+    class MetadataTable
+    {
+        static_assert(IndexBits > 0 && IndexBits < 32, "a guid needs both index and generation bits");
+
+    public:
+        /**
+         * @brief Unpacked copy of a row
+         *
+         */
+        struct Record
+        {
+            uint32_t guid = 0;
+            Kind kind = Kind::client;
+            Status status = Status::open;
+            bool state = false;
+            uint32_t name = 0;
+            uint64_t version = 0;
+            Handle handle;
+        };
+
+        /* Guid Layout */
+        static constexpr uint32_t index_mask = (1u << IndexBits) - 1;
+        static constexpr uint32_t generation_mask = ~0u >> IndexBits;
+
+        /* Freed rows queued per shard before the oldest is reused */
+        static constexpr std::size_t reuse_depth = 64;
+
+        static constexpr uint32_t index_of(uint32_t guid) { return guid & index_mask; }
+        static constexpr uint32_t generation_of(uint32_t guid) { return guid >> IndexBits; }
+        static constexpr uint32_t make_guid(uint32_t index, uint32_t generation) { return (generation << IndexBits) | index; }
+
+    private:
+        /* Flags Layout */
+        static constexpr uint8_t status_mask = 0x07;
+        static constexpr uint8_t state_bit = 0x08;
+        static constexpr uint8_t agent_bit = 0x10;
+        static constexpr uint8_t present_bit = 0x80;
+
+        struct alignas(64) Shard
+        {
+            mutable std::shared_mutex lock;
+            std::vector<uint8_t> flags;
+            std::vector<uint16_t> generations;
+            std::vector<uint32_t> names;
+            std::vector<uint64_t> versions;
+            std::vector<Handle> handles;
+            std::deque<uint32_t> free_rows;
+            std::size_t count = 0;
+        };
+
+        static_assert(generation_mask <= 0xffff, "generations are stored in 16 bits");
+
+        std::array<Shard, ShardCount> m_shards;
+        std::atomic<std::size_t> m_next_shard{0};
+
+        static Shard &shard_for(std::array<Shard, ShardCount> &shards, uint32_t guid) { return shards[index_of(guid) % ShardCount]; }
+        static const Shard &shard_for(const std::array<Shard, ShardCount> &shards, uint32_t guid) { return shards[index_of(guid) % ShardCount]; }
+        static std::size_t row_for(uint32_t guid) { return index_of(guid) / ShardCount; }
+
+        /* Present and still on the generation the guid was handed out with */
+        static bool live(const Shard &shard, std::size_t row, uint32_t guid)
+        {
+            return row < shard.flags.size() && (shard.flags[row] & present_bit) && shard.generations[row] == generation_of(guid);
+        }
+
+        static bool live(const Shard &shard, std::size_t row, uint32_t guid, Kind kind)
+        {
+            return live(shard, row, guid) && ((shard.flags[row] & agent_bit) != 0) == (kind == Kind::agent);
+        }
+
+        static Record load(const Shard &shard, std::size_t row, uint32_t guid)
+        {
+            uint8_t flags = shard.flags[row];
+            return Record{guid, (flags & agent_bit) ? Kind::agent : Kind::client, static_cast<Status>(flags & status_mask), (flags & state_bit) != 0, shard.names[row], shard.versions[row], shard.handles[row]};
+        }
+
+        static void store(Shard &shard, std::size_t row, const Record &record)
+        {
+            shard.flags[row] = present_bit | (static_cast<uint8_t>(record.status) & status_mask) | (record.state ? state_bit : 0) | (record.kind == Kind::agent ? agent_bit : 0);
+            shard.names[row] = record.name;
+            shard.versions[row] = record.version;
+            shard.handles[row] = record.handle;
+        }
+
+        template <typename Fn>
+        bool update_row(uint32_t guid, bool matches, Shard &shard, std::size_t row, Fn &&fn)
+        {
+            if (!matches)
+                return false;
+
+            Record record = load(shard, row, guid);
+            Kind kind = record.kind;
+
+            fn(record);
+
+            record.guid = guid;
+            record.kind = kind;
+            store(shard, row, record);
+            return true;
+        }
+
+    public:
+        /**
+         * @brief Store a new row, handing out its guid
+         *
+         * Shards are picked round robin, each reuses its oldest freed row once
+         * more than reuse_depth are queued [or it can no longer grow], and
+         * grows otherwise. record.guid is written back on success.
+         *
+         * @return false if every slot index is taken
+         */
+        bool allocate(Record &record)
+        {
+            std::size_t index = m_next_shard.fetch_add(1, std::memory_order_relaxed) % ShardCount;
+            Shard &shard = m_shards[index];
+            std::unique_lock<std::shared_mutex> lock(shard.lock);
+
+            std::size_t row = shard.flags.size();
+            bool full = row * ShardCount + index > index_mask;
+
+            if (!shard.free_rows.empty() && (full || shard.free_rows.size() > reuse_depth))
+            {
+                row = shard.free_rows.front();
+                shard.free_rows.pop_front();
+            }
+            else
+            {
+                if (full)
+                    return false;
+
+                shard.flags.push_back(0);
+                shard.generations.push_back(1);
+                shard.names.push_back(0);
+                shard.versions.push_back(0);
+                shard.handles.emplace_back();
+            }
+
+            record.guid = make_guid(static_cast<uint32_t>(row * ShardCount + index), shard.generations[row]);
+            store(shard, row, record);
+            shard.count++;
+            return true;
+        }
+
+        /**
+         * @brief Free the row of a guid for reuse
+         *
+         * @return true if the guid was live
+         */
+        bool erase(uint32_t guid)
+        {
+            Record removed;
+            return erase(guid, removed);
+        }
+
+        /**
+         * @brief Free the row of a guid for reuse, copying it into removed first
+         *
+         * A row on the last generation is retired, never queued again.
+         *
+         * @return true if the guid was live
+         */
+        bool erase(uint32_t guid, Record &removed)
+        {
+            Shard &shard = shard_for(m_shards, guid);
+            std::size_t row = row_for(guid);
+            std::unique_lock<std::shared_mutex> lock(shard.lock);
+
+            if (!live(shard, row, guid))
+                return false;
+
+            removed = load(shard, row, guid);
+
+            shard.flags[row] = 0;
+            shard.names[row] = 0;
+            shard.versions[row] = 0;
+            shard.handles[row] = Handle();
+            shard.count--;
+
+            if (shard.generations[row] == generation_mask)
+                return true;
+
+            shard.generations[row]++;
+            shard.free_rows.push_back(static_cast<uint32_t>(row));
+            return true;
+        }
+
+        /**
+         * @brief Check if a guid is live
+         *
+         */
+        bool contains(uint32_t guid) const
+        {
+            const Shard &shard = shard_for(m_shards, guid);
+            std::shared_lock<std::shared_mutex> lock(shard.lock);
+            return live(shard, row_for(guid), guid);
+        }
+
+        /**
+         * @brief Copy the row of a guid into out
+         *
+         * @return true if the guid was live [and of the given kind]
+         */
+        bool find(uint32_t guid, Record &out) const
+        {
+            const Shard &shard = shard_for(m_shards, guid);
+            std::size_t row = row_for(guid);
+            std::shared_lock<std::shared_mutex> lock(shard.lock);
+
+            if (!live(shard, row, guid))
+                return false;
+
+            out = load(shard, row, guid);
+            return true;
+        }
+
+        bool find(uint32_t guid, Kind kind, Record &out) const
+        {
+            const Shard &shard = shard_for(m_shards, guid);
+            std::size_t row = row_for(guid);
+            std::shared_lock<std::shared_mutex> lock(shard.lock);
+
+            if (!live(shard, row, guid, kind))
+                return false;
+
+            out = load(shard, row, guid);
+            return true;
+        }
+
+        /**
+         * @brief Run fn(Record &) on a guid and write the record back
+         *
+         * Stale or unknown guids are left untouched, nothing is inserted.
+         * The guid and kind of a row never change.
+         *
+         * @return true if the guid was live [and of the given kind]
+         */
+        template <typename Fn>
+        bool update(uint32_t guid, Fn &&fn)
+        {
+            Shard &shard = shard_for(m_shards, guid);
+            std::size_t row = row_for(guid);
+            std::unique_lock<std::shared_mutex> lock(shard.lock);
+            return update_row(guid, live(shard, row, guid), shard, row, std::forward<Fn>(fn));
+        }
+
+        template <typename Fn>
+        bool update(uint32_t guid, Kind kind, Fn &&fn)
+        {
+            Shard &shard = shard_for(m_shards, guid);
+            std::size_t row = row_for(guid);
+            std::unique_lock<std::shared_mutex> lock(shard.lock);
+            return update_row(guid, live(shard, row, guid, kind), shard, row, std::forward<Fn>(fn));
+        }
+
+        /**
+         * @brief Run fn(const Record &) on every live row [of the given kind]
+         *
+         * Rows are walked shard by shard, freed rows waiting for reuse are
+         * the only holes.
+         */
+        template <typename Fn>
+        void for_each(Fn &&fn) const
+        {
+            for (std::size_t index = 0; index < ShardCount; ++index)
+            {
+                const Shard &shard = m_shards[index];
+                std::shared_lock<std::shared_mutex> lock(shard.lock);
+
+                for (std::size_t row = 0; row < shard.flags.size(); ++row)
+                    if (shard.flags[row] & present_bit)
+                        fn(load(shard, row, make_guid(static_cast<uint32_t>(row * ShardCount + index), shard.generations[row])));
+            }
+        }
+
+        template <typename Fn>
+        void for_each(Kind kind, Fn &&fn) const
+        {
+            uint8_t expected = present_bit | (kind == Kind::agent ? agent_bit : 0);
+
+            for (std::size_t index = 0; index < ShardCount; ++index)
+            {
+                const Shard &shard = m_shards[index];
+                std::shared_lock<std::shared_mutex> lock(shard.lock);
+
+                for (std::size_t row = 0; row < shard.flags.size(); ++row)
+                    if ((shard.flags[row] & (present_bit | agent_bit)) == expected)
+                        fn(load(shard, row, make_guid(static_cast<uint32_t>(row * ShardCount + index), shard.generations[row])));
+            }
+        }
+
+        /**
+         * @brief Number of live rows
+         *
+         */
+        std::size_t size() const
+        {
+            std::size_t result = 0;
+            for (const Shard &shard : m_shards)
+            {
+                std::shared_lock<std::shared_mutex> lock(shard.lock);
+                result += shard.count;
+            }
+            return result;
+        }
+
+        /**
+         * @brief Heap bytes reserved by the columns
+         *
+         */
+        std::size_t memory_usage() const
+        {
+            std::size_t bytes = 0;
+            for (const Shard &shard : m_shards)
+            {
+                std::shared_lock<std::shared_mutex> lock(shard.lock);
+                bytes += shard.flags.capacity() * sizeof(uint8_t);
+                bytes += shard.generations.capacity() * sizeof(uint16_t);
+                bytes += shard.names.capacity() * sizeof(uint32_t);
+                bytes += shard.versions.capacity() * sizeof(uint64_t);
+                bytes += shard.handles.capacity() * sizeof(Handle);
+                bytes += shard.free_rows.size() * sizeof(uint32_t);
+            }
+            return bytes;
+        }
+    };
+
+} // namespace Horus
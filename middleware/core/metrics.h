@@ -0,0 +1,190 @@
+/**
+ * @file metrics.h
+ * @brief Sharded Counters and Prometheus Text Exposition
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <string>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+
+namespace Horus
+{
+    namespace Metrics
+    {
+        constexpr std::size_t shard_count = 16;
+
+        /**
+         * @brief Shard of the calling thread
+         *
+         * Threads are spread round robin on first use, so up to
+         * shard_count threads never write the same cache line.
+         */
+        inline std::size_t thread_shard()
+        {
+            static std::atomic<std::size_t> next{0};
+            static thread_local std::size_t shard = next++ % shard_count;
+            return shard;
+        }
+
+        /**
+         * @brief Counter split across cache line sized shards
+         *
+         * Writers only touch the shard of their thread, readers add the
+         * shards up, so the hot path never bounces a line between cores.
+         *
+         * @tparam T Counted type, signed for gauges that go down
+         */
+        template <typename T>
+        class ShardedCounter
+        {
+        private:
+            struct alignas(64) Cell
+            {
+                std::atomic<T> value{0};
+            };
+
+            std::array<Cell, shard_count> m_cells;
+
+        public:
+            void add(T amount = 1)
+            {
+                m_cells[thread_shard()].value.fetch_add(amount, std::memory_order_relaxed);
+            }
+
+            void sub(T amount = 1)
+            {
+                m_cells[thread_shard()].value.fetch_sub(amount, std::memory_order_relaxed);
+            }
+
+            T value() const
+            {
+                T result = 0;
+
+                for (const Cell &cell : m_cells)
+                    result += cell.value.load(std::memory_order_relaxed);
+
+                return result;
+            }
+        };
+
+        typedef ShardedCounter<uint64_t> Counter;
+        typedef ShardedCounter<int64_t> Gauge;
+
+        /**
+         * @brief Cumulative histogram over fixed upper bounds
+         *
+         * @tparam Bounds Number of finite buckets, +Inf is implied
+         */
+        template <std::size_t Bounds>
+        class BucketCounter
+        {
+        private:
+            std::array<uint64_t, Bounds> m_bounds;
+            std::array<Counter, Bounds + 1> m_counts;
+            Counter m_sum;
+
+        public:
+            explicit BucketCounter(const std::array<uint64_t, Bounds> &bounds)
+                : m_bounds(bounds)
+            {
+            }
+
+            void observe(uint64_t value)
+            {
+                std::size_t bucket = 0;
+
+                while (bucket < Bounds && value > m_bounds[bucket])
+                    ++bucket;
+
+                m_counts[bucket].add();
+                m_sum.add(value);
+            }
+
+            const std::array<uint64_t, Bounds> &bounds() const { return m_bounds; }
+
+            /**
+             * @brief Samples at or below a bound [Bounds is +Inf]
+             *
+             */
+            uint64_t cumulative(std::size_t bucket) const
+            {
+                uint64_t result = 0;
+
+                for (std::size_t index = 0; index <= bucket && index <= Bounds; ++index)
+                    result += m_counts[index].value();
+
+                return result;
+            }
+
+            uint64_t count() const { return cumulative(Bounds); }
+            uint64_t sum() const { return m_sum.value(); }
+        };
+
+        /**
+         * @brief Prometheus text format [version 0.0.4] writer
+         *
+         * Labels are passed preformatted, as in type="auth",stage="parse".
+         */
+        class Exposition
+        {
+        private:
+            std::string m_text;
+
+        public:
+            static constexpr const char *content_type = "text/plain; version=0.0.4; charset=utf-8";
+
+            /**
+             * @brief Start a metric family
+             *
+             * @param type counter, gauge, histogram or summary
+             */
+            void family(const char *name, const char *help, const char *type)
+            {
+                m_text.append("# HELP ").append(name).append(" ").append(help).append("\n");
+                m_text.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+            }
+
+            void sample(const char *name, const std::string &labels, uint64_t value)
+            {
+                open(name, labels);
+                m_text.append(std::to_string(value)).append("\n");
+            }
+
+            void sample(const char *name, const std::string &labels, int64_t value)
+            {
+                open(name, labels);
+                m_text.append(std::to_string(value)).append("\n");
+            }
+
+            void sample(const char *name, const std::string &labels, double value)
+            {
+                char buffer[32];
+                std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+
+                open(name, labels);
+                m_text.append(buffer).append("\n");
+            }
+
+            const std::string &text() const { return m_text; }
+
+        private:
+            void open(const char *name, const std::string &labels)
+            {
+                m_text.append(name);
+
+                if (!labels.empty())
+                    m_text.append("{").append(labels).append("}");
+
+                m_text.append(" ");
+            }
+        };
+
+    } // namespace Metrics
+
+} // namespace Horus
@@ -0,0 +1,292 @@
+/**
+ * @file pool.h
+ * @brief Recycled Object Pool
+ *
+ */
+
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+namespace Horus
+{
+    /**
+     * @brief Counters of a pool
+     *
+     */
+    struct PoolStats
+    {
+        uint64_t reused = 0;
+        uint64_t allocated = 0;
+        uint64_t discarded = 0;
+    };
+
+    /**
+     * @brief Free lists of heap objects kept for reuse, bounded by the bytes they retain
+     *
+     * Objects handed back stay allocated, together with whatever heap
+     * memory they own, until someone takes them again. Every thread keeps
+     * its own free list, so take and give lock nothing on the steady path.
+     * A list grown past thread_bytes moves its older half to a shared
+     * depot and a list that runs dry refills from it, so objects released
+     * on one thread still reach the others. At most max_bytes are retained
+     * across every list, the rest are freed on release.
+     *
+     * @tparam T Pooled type
+     */
+    template <typename T>
+    class ObjectPool
+    {
+    private:
+        struct Entry
+        {
+            std::unique_ptr<T> object;
+            std::size_t bytes = 0;
+        };
+
+        /* State the thread lists may outlive the pool with */
+        struct Shared
+        {
+            std::mutex lock;
+            std::vector<Entry> depot;
+            std::atomic<std::size_t> bytes{0};
+            std::atomic<std::size_t> count{0};
+        };
+
+        struct Local
+        {
+            const Shared *key = nullptr;
+            std::weak_ptr<Shared> shared;
+            std::vector<Entry> free;
+            std::size_t bytes = 0;
+        };
+
+        /* Lists of one thread [one per pool it touched], their budget is handed back on thread exit */
+        struct Locals
+        {
+            bool *exited;
+            std::vector<Local> lists;
+
+            explicit Locals(bool *exited)
+                : exited(exited)
+            {
+            }
+
+            ~Locals()
+            {
+                *exited = true;
+
+                for (Local &list : lists)
+                {
+                    if (std::shared_ptr<Shared> shared = list.shared.lock())
+                    {
+                        shared->bytes -= list.bytes;
+                        shared->count -= list.free.size();
+                    }
+                }
+            }
+        };
+
+        std::shared_ptr<Shared> m_shared;
+        std::size_t m_max_bytes;
+        std::size_t m_thread_bytes;
+
+        std::atomic<uint64_t> m_reused{0};
+        std::atomic<uint64_t> m_allocated{0};
+        std::atomic<uint64_t> m_discarded{0};
+
+        /* List of the calling thread, null once its thread storage is gone [release during thread or static teardown] */
+        Local *local()
+        {
+            static thread_local bool exited = false;
+
+            if (exited)
+                return nullptr;
+
+            static thread_local Locals locals(&exited);
+
+            Local *vacant = nullptr;
+
+            for (Local &list : locals.lists)
+            {
+                if (list.shared.expired())
+                {
+                    vacant = &list;
+                    continue;
+                }
+
+                if (list.key == m_shared.get())
+                    return &list;
+            }
+
+            /* Take over the list of a destroyed pool, its objects were never counted here */
+            if (!vacant)
+            {
+                locals.lists.emplace_back();
+                vacant = &locals.lists.back();
+            }
+
+            vacant->key = m_shared.get();
+            vacant->shared = m_shared;
+            vacant->free.clear();
+            vacant->bytes = 0;
+            return vacant;
+        }
+
+        /* Claim budget for bytes more retained memory */
+        bool reserve(std::size_t bytes)
+        {
+            std::size_t current = m_shared->bytes.load(std::memory_order_relaxed);
+
+            do
+            {
+                if (bytes > m_max_bytes || current > m_max_bytes - bytes)
+                    return false;
+            } while (!m_shared->bytes.compare_exchange_weak(current, current + bytes, std::memory_order_relaxed));
+
+            return true;
+        }
+
+        /* Move the older half of a list to the depot */
+        void spill(Local &list)
+        {
+            std::size_t moved = 0;
+            std::size_t bytes = 0;
+
+            while (moved < list.free.size() && list.bytes - bytes > m_thread_bytes / 2)
+                bytes += list.free[moved++].bytes;
+
+            std::lock_guard<std::mutex> lock(m_shared->lock);
+
+            for (std::size_t i = 0; i < moved; ++i)
+                m_shared->depot.push_back(std::move(list.free[i]));
+
+            list.free.erase(list.free.begin(), list.free.begin() + static_cast<std::ptrdiff_t>(moved));
+            list.bytes -= bytes;
+        }
+
+        /* Pull up to half a list worth of objects from the depot */
+        void refill(Local &list)
+        {
+            std::lock_guard<std::mutex> lock(m_shared->lock);
+
+            while (!m_shared->depot.empty() && (list.free.empty() || list.bytes + m_shared->depot.back().bytes <= m_thread_bytes / 2))
+            {
+                list.bytes += m_shared->depot.back().bytes;
+                list.free.push_back(std::move(m_shared->depot.back()));
+                m_shared->depot.pop_back();
+            }
+        }
+
+    public:
+        /**
+         * @param max_bytes Bytes retained across every list
+         * @param thread_bytes Bytes a thread list holds before spilling to the depot
+         */
+        explicit ObjectPool(std::size_t max_bytes = 16 * 1024 * 1024, std::size_t thread_bytes = 1024 * 1024)
+            : m_shared(std::make_shared<Shared>()), m_max_bytes(max_bytes), m_thread_bytes(thread_bytes < max_bytes ? thread_bytes : max_bytes)
+        {
+        }
+
+        /**
+         * @brief Take a recycled object
+         *
+         * @return null if none is free, the caller allocates and reports it with allocated()
+         */
+        std::unique_ptr<T> take()
+        {
+            Local *list = local();
+
+            if (!list)
+                return nullptr;
+
+            if (list->free.empty())
+                refill(*list);
+
+            if (list->free.empty())
+                return nullptr;
+
+            Entry entry = std::move(list->free.back());
+            list->free.pop_back();
+            list->bytes -= entry.bytes;
+
+            m_shared->bytes -= entry.bytes;
+            m_shared->count--;
+            m_reused++;
+            return std::move(entry.object);
+        }
+
+        /**
+         * @brief Count an object allocated because the pool was empty
+         *
+         */
+        void allocated()
+        {
+            m_allocated++;
+        }
+
+        /**
+         * @brief Hand an object back, retaining bytes of memory
+         *
+         * @return false if the pool was full and the object was freed
+         */
+        bool give(std::unique_ptr<T> object, std::size_t bytes)
+        {
+            Local *list = local();
+
+            if (!list || !reserve(bytes))
+            {
+                m_discarded++;
+                return false;
+            }
+
+            list->free.push_back(Entry{std::move(object), bytes});
+            list->bytes += bytes;
+            m_shared->count++;
+
+            if (list->bytes > m_thread_bytes)
+                spill(*list);
+
+            return true;
+        }
+
+        /**
+         * @brief Count an object freed instead of handed back
+         *
+         */
+        void discarded()
+        {
+            m_discarded++;
+        }
+
+        /**
+         * @brief Number of objects waiting for reuse
+         *
+         */
+        std::size_t size() const
+        {
+            return m_shared->count;
+        }
+
+        /**
+         * @brief Bytes retained by the objects waiting for reuse
+         *
+         */
+        std::size_t bytes() const
+        {
+            return m_shared->bytes;
+        }
+
+        PoolStats stats() const
+        {
+            return PoolStats{m_reused, m_allocated, m_discarded};
+        }
+    };
+
+} // namespace Horus
@@ -0,0 +1,316 @@
+/**
+ * @file registry.h
+ * @brief Sharded Concurrent Registry
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <functional>
+#include <unordered_map>
+
+namespace Horus
+{
+    /**
+     * @brief Hash map split into independently locked shards
+     *
+     * Every key lives in exactly one shard, picked by its hash, so workers
+     * touching different keys rarely contend on the same lock. Lookups take
+     * a shared lock, mutations take an exclusive lock on a single shard.
+     *
+     * @tparam Key Key type
+     * @tparam Value Value type
+     * @tparam Hash Hash functor used for both shard selection and buckets
+     * @tparam ShardCount Number of shards
+     */
+    template <typename Key, typename Value, typename Hash = std::hash<Key>, std::size_t ShardCount = 16>
+    class ShardedMap
+    {
+    private:
+        /**
+         * @brief One lock plus the keys hashed into it
+         *
+         */
+        struct alignas(64) Shard
+        {
+            mutable std::shared_mutex lock;
+            std::unordered_map<Key, Value, Hash> map;
+        };
+
+        std::array<Shard, ShardCount> m_shards;
+
+        /* Pointer keys are aligned and std::hash is the identity on them, mix before picking */
+        static std::size_t shard_index(const Key &key)
+        {
+            uint64_t hash = static_cast<uint64_t>(Hash{}(key));
+            hash ^= hash >> 33;
+            hash *= 0xff51afd7ed558ccdULL;
+            hash ^= hash >> 33;
+            return static_cast<std::size_t>(hash % ShardCount);
+        }
+
+        Shard &shard_for(const Key &key) { return m_shards[shard_index(key)]; }
+        const Shard &shard_for(const Key &key) const { return m_shards[shard_index(key)]; }
+
+    public:
+        /**
+         * @brief Insert or replace a value
+         *
+         * @return true if the key was not present
+         */
+        bool insert(const Key &key, Value value)
+        {
+            Shard &shard = shard_for(key);
+            std::unique_lock<std::shared_mutex> lock(shard.lock);
+            return shard.map.insert_or_assign(key, std::move(value)).second;
+        }
+
+        /**
+         * @brief Remove a key
+         *
+         * @return true if the key was present
+         */
+        bool erase(const Key &key)
+        {
+            Shard &shard = shard_for(key);
+            std::unique_lock<std::shared_mutex> lock(shard.lock);
+            return shard.map.erase(key) > 0;
+        }
+
+        /**
+         * @brief Copy the value of a key into out
+         *
+         * @return true if the key was found
+         */
+        bool find(const Key &key, Value &out) const
+        {
+            const Shard &shard = shard_for(key);
+            std::shared_lock<std::shared_mutex> lock(shard.lock);
+
+            auto it = shard.map.find(key);
+            if (it == shard.map.end())
+                return false;
+
+            out = it->second;
+            return true;
+        }
+
+        /**
+         * @brief Check if a key is present
+         *
+         */
+        bool contains(const Key &key) const
+        {
+            const Shard &shard = shard_for(key);
+            std::shared_lock<std::shared_mutex> lock(shard.lock);
+            return shard.map.find(key) != shard.map.end();
+        }
+
+        /**
+         * @brief Run fn(Value &) on a key while holding its shard exclusively
+         *
+         * Unknown keys are left untouched, nothing is default inserted.
+         *
+         * @return true if the key was found
+         */
+        template <typename Fn>
+        bool update(const Key &key, Fn &&fn)
+        {
+            Shard &shard = shard_for(key);
+            std::unique_lock<std::shared_mutex> lock(shard.lock);
+
+            auto it = shard.map.find(key);
+            if (it == shard.map.end())
+                return false;
+
+            fn(it->second);
+            return true;
+        }
+
+        /**
+         * @brief Run fn(Value &) on a key, default inserting it first
+         *
+         */
+        template <typename Fn>
+        void upsert(const Key &key, Fn &&fn)
+        {
+            Shard &shard = shard_for(key);
+            std::unique_lock<std::shared_mutex> lock(shard.lock);
+            fn(shard.map[key]);
+        }
+
+        /**
+         * @brief Remove a key if pred(const Value &) holds
+         *
+         * @return true if the key was removed
+         */
+        template <typename Pred>
+        bool erase_if(const Key &key, Pred &&pred)
+        {
+            Shard &shard = shard_for(key);
+            std::unique_lock<std::shared_mutex> lock(shard.lock);
+
+            auto it = shard.map.find(key);
+            if (it == shard.map.end() || !pred(it->second))
+                return false;
+
+            shard.map.erase(it);
+            return true;
+        }
+
+        /**
+         * @brief Run fn(const Key &, const Value &) on every entry
+         *
+         * Shards are visited one at a time under a shared lock, so the walk is
+         * not a consistent snapshot of the whole map.
+         */
+        template <typename Fn>
+        void for_each(Fn &&fn) const
+        {
+            for (const Shard &shard : m_shards)
+            {
+                std::shared_lock<std::shared_mutex> lock(shard.lock);
+                for (const auto &entry : shard.map)
+                    fn(entry.first, entry.second);
+            }
+        }
+
+        /**
+         * @brief Copy every value out of the map
+         *
+         */
+        std::vector<Value> values() const
+        {
+            std::vector<Value> result;
+            for_each([&](const Key &, const Value &value) { result.push_back(value); });
+            return result;
+        }
+
+        /**
+         * @brief Number of entries across all shards
+         *
+         */
+        std::size_t size() const
+        {
+            std::size_t result = 0;
+            for (const Shard &shard : m_shards)
+            {
+                std::shared_lock<std::shared_mutex> lock(shard.lock);
+                result += shard.map.size();
+            }
+            return result;
+        }
+    };
+
+    /**
+     * @brief Set of values kept contiguous for fast iteration
+     *
+     * Values live in a packed vector, a side table maps each key to its slot.
+     * Removal moves the last value into the freed slot, so both insert and
+     * erase are O(1) and iteration is a linear pass without holes.
+     *
+     * @tparam Key Key type
+     * @tparam Value Value type
+     */
+    template <typename Key, typename Value, typename Hash = std::hash<Key>>
+    class DenseIndex
+    {
+    private:
+        mutable std::shared_mutex m_lock;
+        std::vector<Key> m_keys;
+        std::vector<Value> m_values;
+        std::unordered_map<Key, std::size_t, Hash> m_slots;
+
+    public:
+        /**
+         * @brief Insert or replace a value
+         *
+         * @return true if the key was not present
+         */
+        bool insert(const Key &key, Value value)
+        {
+            std::unique_lock<std::shared_mutex> lock(m_lock);
+
+            auto it = m_slots.find(key);
+            if (it != m_slots.end())
+            {
+                m_values[it->second] = std::move(value);
+                return false;
+            }
+
+            m_slots.emplace(key, m_values.size());
+            m_keys.push_back(key);
+            m_values.push_back(std::move(value));
+            return true;
+        }
+
+        /**
+         * @brief Remove a key, filling its slot with the last value
+         *
+         * @return true if the key was present
+         */
+        bool erase(const Key &key)
+        {
+            std::unique_lock<std::shared_mutex> lock(m_lock);
+
+            auto it = m_slots.find(key);
+            if (it == m_slots.end())
+                return false;
+
+            std::size_t slot = it->second;
+            std::size_t last = m_values.size() - 1;
+
+            if (slot != last)
+            {
+                m_keys[slot] = std::move(m_keys[last]);
+                m_values[slot] = std::move(m_values[last]);
+                m_slots[m_keys[slot]] = slot;
+            }
+
+            m_keys.pop_back();
+            m_values.pop_back();
+            m_slots.erase(it);
+            return true;
+        }
+
+        /**
+         * @brief Check if a key is present
+         *
+         */
+        bool contains(const Key &key) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_lock);
+            return m_slots.find(key) != m_slots.end();
+        }
+
+        /**
+         * @brief Run fn(const Key &, const Value &) on every entry
+         *
+         * Writers wait until the walk ends, keep fn short.
+         */
+        template <typename Fn>
+        void for_each(Fn &&fn) const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_lock);
+            for (std::size_t i = 0; i < m_values.size(); ++i)
+                fn(m_keys[i], m_values[i]);
+        }
+
+        /**
+         * @brief Number of entries
+         *
+         */
+        std::size_t size() const
+        {
+            std::shared_lock<std::shared_mutex> lock(m_lock);
+            return m_values.size();
+        }
+    };
+
+} // namespace Horus
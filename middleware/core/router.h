@@ -0,0 +1,106 @@
+/**
+ * @file router.h
+ * @brief Precompiled Handshake Route Table
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <string_view>
+#include <initializer_list>
+
+namespace Horus
+{
+    /**
+     * @brief Exact path to value table built once at startup
+     *
+     * Routes are kept sorted by length and then bytes, so a lookup is a
+     * binary search that rejects most wrong paths on their length alone and
+     * never allocates. The table is not synchronized, fill it before the
+     * server starts and only read it afterwards.
+     *
+     * @tparam Value Value bound to each path
+     */
+    template <typename Value>
+    class RouteTable
+    {
+    private:
+        typedef std::pair<std::string, Value> Route;
+
+        std::vector<Route> m_routes;
+
+        static bool before(std::string_view lhs, std::string_view rhs)
+        {
+            return lhs.size() != rhs.size() ? lhs.size() < rhs.size() : lhs < rhs;
+        }
+
+    public:
+        RouteTable() = default;
+
+        RouteTable(std::initializer_list<Route> routes)
+        {
+            for (const Route &route : routes)
+                add(route.first, route.second);
+        }
+
+        /**
+         * @brief Bind a path to a value, replacing any previous binding
+         *
+         */
+        void add(std::string path, Value value)
+        {
+            auto it = std::lower_bound(m_routes.begin(), m_routes.end(), path, [](const Route &route, const std::string &key) { return before(route.first, key); });
+
+            if (it != m_routes.end() && it->first == path)
+            {
+                it->second = std::move(value);
+                return;
+            }
+
+            m_routes.emplace(it, std::move(path), std::move(value));
+        }
+
+        /**
+         * @brief Find the value of a request resource
+         *
+         * The query string is ignored, the path itself must match exactly.
+         *
+         * @return true if the path is routed
+         */
+        bool match(std::string_view resource, Value &out) const
+        {
+            std::string_view path = path_of(resource);
+
+            auto it = std::lower_bound(m_routes.begin(), m_routes.end(), path, [](const Route &route, std::string_view key) { return before(route.first, key); });
+
+            if (it == m_routes.end() || it->first != path)
+                return false;
+
+            out = it->second;
+            return true;
+        }
+
+        /**
+         * @brief Resource without its query string
+         *
+         */
+        static std::string_view path_of(std::string_view resource)
+        {
+            return resource.substr(0, resource.find('?'));
+        }
+
+        /**
+         * @brief Number of routes
+         *
+         */
+        std::size_t size() const
+        {
+            return m_routes.size();
+        }
+    };
+
+} // namespace Horus
@@ -0,0 +1,67 @@
+/**
+ * @file server_config.h
+ * @brief Middleware Endpoint Config and Tunables
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#ifndef MIDDLEWARE_READ_BUFFER_SIZE
+#define MIDDLEWARE_READ_BUFFER_SIZE 4096
+#endif
+
+namespace Horus
+{
+    namespace Server
+    {
+        /**
+         * @brief Runtime tunables applied to the endpoint before it listens
+         *
+         * The defaults favour many mostly idle agents exchanging small frames
+         * over few connections moving large payloads.
+         */
+        struct Tuning
+        {
+            /* Largest message accepted before the connection is closed [bytes, stock 32 MB] */
+            std::size_t max_message_size = 1024 * 1024;
+
+            /* Time a peer gets to finish the opening handshake [ms, stock 5000] */
+            long open_handshake_timeout = 10000;
+
+            /* Time a peer gets to answer the closing handshake [ms, stock 5000, dead peers never answer] */
+            long close_handshake_timeout = 2000;
+
+            /* Pending connections the kernel queues while the workers catch up [capped by somaxconn] */
+            int listen_backlog = 4096;
+
+            /* Send small frames right away instead of waiting to coalesce them */
+            bool tcp_nodelay = true;
+        };
+
+        /**
+         * @brief Compile time limits of a websocketpp config
+         *
+         * The read buffer lives inline in every connection, so it can only be
+         * set at build time [MIDDLEWARE_READ_BUFFER_SIZE, stock 16 KiB]. The
+         * other limits are the defaults Tuning overrides at runtime.
+         *
+         * @tparam base Config being extended
+         */
+        template <typename base>
+        struct Config : public base
+        {
+            typedef Config type;
+
+            static const std::size_t connection_read_buffer_size = MIDDLEWARE_READ_BUFFER_SIZE;
+
+            static const std::size_t max_message_size = 1024 * 1024;
+
+            static const long timeout_open_handshake = 10000;
+            static const long timeout_close_handshake = 2000;
+        };
+
+    } // namespace Server
+
+} // namespace Horus
@@ -14,12 +14,44 @@ int main(int argc, char **argv)
 {
     /* Args variables */
     uint16_t port = 9002;
+    uint32_t threads = 1;
+    uint32_t conflation = 0;
+    uint32_t batch_interval = 0;
+    std::size_t batch_size = 64;
+    std::size_t outbound_limit = 1024 * 1024;
+    std::string slow_policy_name = "conflate";
+    uint32_t heartbeat_interval = 10000;
+    uint32_t heartbeat_timeout = 30000;
+    Horus::Server::Tuning tuning;
+    bool no_tcp_nodelay = false;
+    uint32_t deflate_window_bits = 15;
+    bool deflate_no_context_takeover = false;
+    std::string trace_file = "middleware.trace";
 
     /* Set cli options */
-    clipp::group cli(clipp::required("-p", "--port").doc("port to listen on") & clipp::value("port", port));
+    clipp::group cli(
+        clipp::required("-p", "--port").doc("port to listen on") & clipp::value("port", port),
+        clipp::option("-t", "--threads").doc("number of worker threads [default: 1]") & clipp::value("threads", threads),
+        clipp::option("-c", "--conflation").doc("agent update conflation window in ms, 0 disables it [default: 0]") & clipp::value("ms", conflation),
+        clipp::option("-b", "--batch-interval").doc("broadcast batching interval in ms, 0 disables it [default: 0]") & clipp::value("ms", batch_interval),
+        clipp::option("--batch-size").doc("events per batch frame before it is sent early [default: 64]") & clipp::value("events", batch_size),
+        clipp::option("-l", "--outbound-limit").doc("bytes queued per client before it counts as slow, 0 disables it [default: 1048576]") & clipp::value("bytes", outbound_limit),
+        clipp::option("-s", "--slow-policy").doc("slow client policy [drop|conflate|disconnect, default: conflate]") & clipp::value("policy", slow_policy_name),
+        clipp::option("--heartbeat-interval").doc("ping peers idle for this many ms, 0 disables heartbeats [default: 10000]") & clipp::value("ms", heartbeat_interval),
+        clipp::option("--heartbeat-timeout").doc("close peers silent for this many ms [default: 30000]") & clipp::value("ms", heartbeat_timeout),
+        clipp::option("--max-message-size").doc("largest message accepted in bytes [default: 1048576]") & clipp::value("bytes", tuning.max_message_size),
+        clipp::option("--open-timeout").doc("opening handshake timeout in ms [default: 10000]") & clipp::value("ms", tuning.open_handshake_timeout),
+        clipp::option("--close-timeout").doc("closing handshake timeout in ms [default: 2000]") & clipp::value("ms", tuning.close_handshake_timeout),
+        clipp::option("--backlog").doc("listen backlog [default: 4096]") & clipp::value("connections", tuning.listen_backlog),
+        clipp::option("--no-tcp-nodelay").set(no_tcp_nodelay).doc("let the kernel coalesce small frames [Nagle]"),
+        clipp::option("--deflate-window-bits").doc("permessage-deflate window bits [8-15, default: 15]") & clipp::value("bits", deflate_window_bits),
+        clipp::option("--deflate-no-context-takeover").set(deflate_no_context_takeover).doc("reset the compressor after every message"),
+        clipp::option("--trace-file").doc("profile output [.json for Chrome JSON, default: middleware.trace]") & clipp::value("path", trace_file));
 
     /* Parse the args */
-    if (!clipp::parse(argc, argv, cli))
+    slow_consumer_policy_t slow_policy = slow_consumer_policy_t::conflate;
+
+    if (!clipp::parse(argc, argv, cli) || !slow_consumer_policy_from_string(slow_policy_name, slow_policy))
     {
         /* Show help */
         std::cout << clipp::make_man_page(cli, "middleware");
@@ -29,8 +61,12 @@ int main(int argc, char **argv)
         return 0;
     }
 
+    /* Compression Tunables [used when built with ENABLE_PERMESSAGE_DEFLATE] */
+    Horus::Deflate::settings().max_window_bits = Horus::Deflate::clamp_window_bits(deflate_window_bits);
+    Horus::Deflate::settings().no_context_takeover = deflate_no_context_takeover;
+
     /* Starts Profile Session */
-    H_PROFILE_BEGIN_SESSION("Application Profile", "profile_results.json");
+    H_PROFILE_BEGIN_SESSION("Application Profile", trace_file);
 
     {
         /* Profiles the Main Function */
@@ -42,8 +78,25 @@ int main(int argc, char **argv)
         /* Middleware Instance */
         Middleware middleware;
 
+        /* Keep only the latest update per agent inside the window */
+        middleware.set_conflation_window(std::chrono::milliseconds(conflation));
+
+        /* Pack broadcast events into batch frames */
+        middleware.set_broadcast_batching(std::chrono::milliseconds(batch_interval), batch_size);
+
+        /* Bound what a stalled client can queue */
+        middleware.set_outbound_limit(outbound_limit);
+        middleware.set_slow_consumer_policy(slow_policy);
+
+        /* Endpoint limits [read buffer size is fixed at build time by MIDDLEWARE_READ_BUFFER_SIZE] */
+        tuning.tcp_nodelay = !no_tcp_nodelay;
+        middleware.set_server_tuning(tuning);
+
+        /* Reap peers that stopped answering */
+        middleware.set_heartbeat(std::chrono::milliseconds(heartbeat_interval), std::chrono::milliseconds(heartbeat_timeout));
+
         /* Start middleware on given port */
-        middleware.run(port);
+        middleware.run(port, threads);
 
         /* Interaction */
         bool done = false;
@@ -53,6 +106,9 @@ int main(int argc, char **argv)
                              "type 'help' to see the commands list\n";
 
         std::string help = "\n[command]    - [description]\n"
+                           "stats        - show handshake, heartbeat, buffer and slow consumer counters\n"
+                           "latency      - show p50/p99/p999 per message type and stage [us]\n"
+                           "trace on|off - start or stop trace capture [profiling builds]\n"
                            "quit         - close all connections and quit\n"
                            "help         - show this help message\n";
 
@@ -67,6 +123,39 @@ int main(int argc, char **argv)
                 done = true;
             else if (input == "help")
                 std::cout << help << std::endl;
+            else if (input == "stats")
+            {
+                handshake_stats_t handshakes = middleware.handshake_stats();
+                heartbeat_stats_t heartbeats = middleware.heartbeat_stats();
+                Horus::PoolStats buffers = middleware.buffer_stats();
+                slow_consumer_stats_t stats = middleware.slow_consumer_stats();
+                std::cout << "\nhandshakes => accepted [" << handshakes.accepted << "] rejected [" << handshakes.rejected << "]"
+                          << "\nheartbeats => timeouts [" << heartbeats.timeouts << "] agents gone [" << heartbeats.agents_gone << "]"
+                          << "\nbuffers => reused [" << buffers.reused << "] allocated [" << buffers.allocated << "] discarded [" << buffers.discarded << "]"
+                          << "\nslow consumers => drops [" << stats.drops << "] conflations [" << stats.conflations << "] disconnects [" << stats.disconnects << "]\n"
+                          << std::endl;
+            }
+            else if (input == "latency")
+            {
+                std::cout << std::endl;
+
+                for (const latency_stats_t &latency : middleware.latency_stats())
+                    std::cout << Horus::Protocol::to_string(latency.message_type) << " " << latency_stage_name(latency.stage) << " => count [" << latency.count << "]"
+                              << " p50 [" << latency.p50 / 1000.0 << "] p99 [" << latency.p99 / 1000.0 << "] p999 [" << latency.p999 / 1000.0 << "] max [" << latency.max / 1000.0 << "]\n";
+
+                std::cout << std::endl;
+            }
+            else if (input == "trace on" || input == "trace off")
+            {
+#ifdef ENABLE_PROFILING
+                H_PROFILE_CAPTURE(input == "trace on");
+                std::cout << "\ntrace capture => [" << (::Horus::Debug::Instrumentor::Instance().capturing() ? "on" : "off") << "]\n"
+                          << std::endl;
+#else
+                std::cout << "\n!> built without profiling\n"
+                          << std::endl;
+#endif
+            }
             else
                 std::cout << "\n!> unrecognized command\ntype 'help' to see the commands list\n " << std::endl;
         }
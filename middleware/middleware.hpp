@@ -14,29 +14,312 @@
 /* JSON parser */
 #include <nlohmann/json.hpp>
 
+/* Sharded Registry */
+#include "core/registry.h"
+
+/* Wire Protocol */
+#include "core/protocol.h"
+
+/* Compact Metadata */
+#include "core/metadata.h"
+
+/* Compression Config */
+#include "core/deflate.h"
+
+/* Handshake Routes */
+#include "core/router.h"
+
+/* Recycled Message Buffers */
+#include "core/message_pool.h"
+
+/* Endpoint Limits */
+#include "core/server_config.h"
+
+/* Latency Histograms */
+#include "core/histogram.h"
+
+/* Metrics Counters */
+#include "core/metrics.h"
+
 /* Server type shortcut */
-typedef websocketpp::server<websocketpp::config::asio> server_t;
+#ifdef ENABLE_PERMESSAGE_DEFLATE
+typedef websocketpp::server<Horus::Server::Config<Horus::Pool::Config<Horus::Deflate::Config>>> server_t;
+#else
+typedef websocketpp::server<Horus::Server::Config<Horus::Pool::Config<websocketpp::config::asio>>> server_t;
+#endif
 typedef websocketpp::connection_hdl con_hdl_t;
-typedef std::set<con_hdl_t, std::owner_less<con_hdl_t>> con_set_t;
-/* Connection Metadata */
-class con_metadata_t
+
+/* Connection Key [address of the connection owned by the handle] */
+typedef const void *con_key_t;
+inline con_key_t con_key(con_hdl_t handle) { return handle.lock().get(); }
+
+/* Connection Metadata [generational guids, kind, status enum, state bit, interned name id and handle per guid] */
+typedef Horus::MetadataTable<con_hdl_t> con_metadata_map_t;
+typedef con_metadata_map_t::Record con_metadata_t;
+
+/* Frame opcode carrying an encoding */
+inline websocketpp::frame::opcode::value opcode_for(Horus::Protocol::Encoding encoding)
+{
+    return encoding == Horus::Protocol::Encoding::json ? websocketpp::frame::opcode::text : websocketpp::frame::opcode::binary;
+}
+
+/* Connection Channel */
+enum class channel_t : uint8_t
+{
+    invalid,
+    clients,
+    agents
+};
+
+inline const char *channel_name(channel_t channel)
+{
+    switch (channel)
+    {
+    case channel_t::clients:
+        return "clients";
+    case channel_t::agents:
+        return "agents";
+    default:
+        return "invalid";
+    }
+}
+
+/* Handshake Route [channel plus the protocol version the path asks for] */
+struct route_t
+{
+    channel_t channel = channel_t::invalid;
+    uint8_t version = 1;
+};
+
+typedef Horus::RouteTable<route_t> route_table_t;
+
+/* Handshake Counters */
+struct handshake_stats_t
+{
+    uint64_t accepted = 0;
+    uint64_t rejected = 0;
+};
+
+/* Heartbeat Counters */
+struct heartbeat_stats_t
+{
+    uint64_t timeouts = 0;
+    uint64_t agents_gone = 0;
+};
+
+/* Registry Sizes [entries held for connections, back to zero once every connection is reaped, tombstones are capped] */
+struct registry_stats_t
+{
+    std::size_t sessions = 0;
+    std::size_t metadata = 0;
+    std::size_t metadata_bytes = 0;
+    std::size_t names = 0;
+    std::size_t names_bytes = 0;
+    std::size_t ready_clients = 0;
+    std::size_t firehose_clients = 0;
+    std::size_t filtered_clients = 0;
+    std::size_t agent_subscribers = 0;
+    std::size_t pending_updates = 0;
+    std::size_t tombstones = 0;
+};
+
+/* Milliseconds on the steady clock [liveness timestamps] */
+inline int64_t steady_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Nanoseconds on the steady clock [latency samples] */
+inline int64_t steady_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Latency Stage [parse and handle per inbound frame, fan out per delivery, end to end from frame to delivery] */
+enum class latency_stage_t : uint8_t
+{
+    parse,
+    handle,
+    fan_out,
+    end_to_end
+};
+
+constexpr std::size_t latency_stage_count = 4;
+
+inline const char *latency_stage_name(latency_stage_t stage)
+{
+    switch (stage)
+    {
+    case latency_stage_t::parse:
+        return "parse";
+    case latency_stage_t::handle:
+        return "handle";
+    case latency_stage_t::fan_out:
+        return "fan_out";
+    default:
+        return "end_to_end";
+    }
+}
+
+/* One histogram per message type and stage */
+typedef Horus::HistogramSet<Horus::Protocol::message_type_count * latency_stage_count> latency_histograms_t;
+
+/* Fan Out Size Buckets [recipients of one delivery] */
+typedef Horus::Metrics::BucketCounter<9> fan_out_buckets_t;
+
+/* Latency Percentiles [ns, of one message type and stage] */
+struct latency_stats_t
+{
+    Horus::Protocol::MessageType message_type = Horus::Protocol::MessageType::invalid;
+    latency_stage_t stage = latency_stage_t::parse;
+    uint64_t count = 0;
+    uint64_t p50 = 0;
+    uint64_t p99 = 0;
+    uint64_t p999 = 0;
+    uint64_t max = 0;
+};
+
+/* Slow Consumer Policy [applied to a client whose outbound buffer is over the limit] */
+enum class slow_consumer_policy_t : uint8_t
+{
+    drop,
+    conflate,
+    disconnect
+};
+
+inline const char *slow_consumer_policy_name(slow_consumer_policy_t policy)
+{
+    switch (policy)
+    {
+    case slow_consumer_policy_t::drop:
+        return "drop";
+    case slow_consumer_policy_t::conflate:
+        return "conflate";
+    default:
+        return "disconnect";
+    }
+}
+
+inline bool slow_consumer_policy_from_string(const std::string &name, slow_consumer_policy_t &policy)
+{
+    for (slow_consumer_policy_t candidate : {slow_consumer_policy_t::drop, slow_consumer_policy_t::conflate, slow_consumer_policy_t::disconnect})
+    {
+        if (name == slow_consumer_policy_name(candidate))
+        {
+            policy = candidate;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Slow Consumer Counters [how often each policy fired] */
+struct slow_consumer_stats_t
+{
+    uint64_t drops = 0;
+    uint64_t conflations = 0;
+    uint64_t disconnects = 0;
+};
+
+/* Agent Subscription Filter [guid set, inclusive guid ranges and name prefixes] */
+struct con_subscription_t
+{
+    std::unordered_set<uint32_t> guids;
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    std::vector<std::string> prefixes;
+
+    bool matches(uint32_t guid, const std::string &name) const
+    {
+        if (guids.count(guid))
+            return true;
+
+        for (const std::pair<uint32_t, uint32_t> &range : ranges)
+            if (guid >= range.first && guid <= range.second)
+                return true;
+
+        for (const std::string &prefix : prefixes)
+            if (name.compare(0, prefix.size(), prefix) == 0)
+                return true;
+
+        return false;
+    }
+};
+
+/* Connection Session [bound into the handlers of its connection on open, reused by every message] */
+class con_session_t
 {
 public:
-    typedef std::shared_ptr<con_metadata_t> ptr;
+    typedef std::shared_ptr<con_session_t> ptr;
 
-    con_metadata_t(std::string status, bool state, std::string name, uint32_t guid, con_hdl_t handle)
-        : status(status), state(state), name(name), guid(guid), handle(handle)
+    con_session_t(channel_t channel, std::string host, con_hdl_t handle, server_t::connection_ptr connection)
+        : channel(channel), host(host), handle(handle), connection(connection)
     {
     }
 
-    std::string status;
-    bool state;
-    std::string name;
+    channel_t channel;
+    std::string host;
     con_hdl_t handle;
-    uint32_t guid;
+
+    /* Sends and buffered amount checks go straight to the connection [its handlers hold the session until close] */
+    const server_t::connection_ptr connection;
+
+    /* Negotiated on handshake */
+    Horus::Protocol::Encoding encoding = Horus::Protocol::Encoding::json;
+
+    /* Filled on auth */
+    uint32_t guid = 0;
+    bool authenticated = false;
+
+    /* Counters */
+    std::atomic<uint64_t> messages_in{0};
+    std::atomic<uint64_t> bytes_in{0};
+
+    /* Liveness [steady ms of the last frame or pong received] */
+    std::atomic<int64_t> last_seen{steady_ms()};
+
+    /* Slow Consumer State [broadcasts held back while the outbound buffer drains] */
+    std::atomic<bool> conflating{false};
+    std::atomic<bool> closing{false};
+    std::mutex outbound_lock;
+    std::vector<uint64_t> pending_order;
+    std::unordered_map<uint64_t, nlohmann::json> pending;
+    server_t::timer_ptr drain_timer;
+
+    /* Agent Subscription [null receives every agent, otherwise the agent guids it currently matches] */
+    std::mutex subscription_lock;
+    std::shared_ptr<const con_subscription_t> subscription;
+    std::unordered_set<uint32_t> subscribed_agents;
+};
+
+typedef Horus::ShardedMap<con_key_t, con_session_t::ptr> con_session_map_t;
+
+/* Ready Clients [broadcast recipients, keyed by guid] */
+typedef Horus::DenseIndex<uint32_t, con_session_t::ptr> con_ready_index_t;
+
+/* Agent Subscribers [agent guid to the filtered clients matching it] */
+typedef Horus::ShardedMap<uint32_t, std::vector<con_session_t::ptr>> con_subscriber_map_t;
+
+/* Broadcast Event [client events reach every ready client, agent events only the interested ones] */
+struct broadcast_event_t
+{
+    bool agent_event = false;
+    uint32_t agent_guid = 0;
+    nlohmann::json message;
+
+    /* Last event of the agent, its subscriber entries are dropped once delivered */
+    bool retire = false;
+
+    /* Steady ns the frame behind the event arrived, zero for events raised by timers and closes */
+    int64_t received = 0;
 };
 
-typedef std::map<uint32_t, con_metadata_t::ptr> con_metadata_map_t;
+/* Conflated Agent Update [newest payload, arrival of the oldest frame it replaced] */
+struct pending_update_t
+{
+    nlohmann::json message;
+    int64_t received = 0;
+};
 
 class Middleware
 {
@@ -44,44 +327,181 @@ public:
     Middleware();
     ~Middleware();
 
-    /* Middleware Loop */
-    void run(uint16_t port = 9002);
+    /* Middleware Loop [port 0 listens on any free port] */
+    void run(uint16_t port = 9002, uint32_t threads = 1);
     void stop();
 
+    /* Port being listened on [the one picked by the system when run with port 0] */
+    uint16_t port() const { return m_port; }
+
+    /* Agent Update Conflation [zero broadcasts every update right away] */
+    void set_conflation_window(std::chrono::milliseconds window) { m_conflation_window = window; }
+
+    /* Broadcast Batching [events sent as one batch frame per interval or size cap, zero interval disables it] */
+    void set_broadcast_batching(std::chrono::milliseconds interval, std::size_t max_events)
+    {
+        m_batch_interval = interval;
+        m_batch_max_events = std::max<std::size_t>(max_events, 1);
+    }
+
+    /* Endpoint Tuning [message size, handshake timeouts, backlog and TCP_NODELAY, applied on run] */
+    void set_server_tuning(const Horus::Server::Tuning &tuning) { m_tuning = tuning; }
+
+    /* Outbound Limit [bytes queued per client before the slow consumer policy applies, zero disables it] */
+    void set_outbound_limit(std::size_t bytes) { m_outbound_limit = bytes; }
+    void set_slow_consumer_policy(slow_consumer_policy_t policy) { m_slow_consumer_policy = policy; }
+
+    /* Slow Consumer Counters */
+    slow_consumer_stats_t slow_consumer_stats() const;
+
+    /* Handshake Counters */
+    handshake_stats_t handshake_stats() const;
+
+    /* Heartbeat [ping idle peers every interval, close the ones silent for longer than timeout, zero interval disables it] */
+    void set_heartbeat(std::chrono::milliseconds interval, std::chrono::milliseconds timeout)
+    {
+        m_heartbeat_interval = interval;
+        m_heartbeat_timeout = std::max(timeout, interval);
+    }
+
+    /* Heartbeat Counters */
+    heartbeat_stats_t heartbeat_stats() const;
+
+    /* Registry Sizes */
+    registry_stats_t registry_stats();
+
+    /* Message Buffer Pool Counters */
+    Horus::PoolStats buffer_stats() const;
+
+    /* Latency Percentiles [every message type and stage with samples] */
+    std::vector<latency_stats_t> latency_stats() const;
+
+    /* Record a latency sample [ns] */
+    void record_latency(Horus::Protocol::MessageType message_type, latency_stage_t stage, int64_t elapsed);
+
     /* Validation Handler */
     bool validate(con_hdl_t handle);
 
+    /* HTTP Handler [plain requests on the websocket port, serves /metrics] */
+    void on_http(con_hdl_t handle);
+
+    /* Every counter in the Prometheus text format */
+    std::string render_metrics();
+
+    /* Socket Init Handler [socket options before the handshake] */
+    void on_socket_init(con_hdl_t handle, websocketpp::lib::asio::ip::tcp::socket &socket);
+
     /* Connection Open Handler */
     void on_open(con_hdl_t handle);
 
     /* Connection Close Handler */
     void on_close(con_hdl_t handle);
 
-    /* Message Handler */
-    void on_message(con_hdl_t handle, server_t::message_ptr message);
+    /* Pong Handler [proves the peer is alive] */
+    void on_pong(const con_session_t::ptr &session, std::string payload);
+
+    /* Heartbeat Timer Handler [pings idle peers and closes the silent ones] */
+    void heartbeat(const websocketpp::lib::error_code &ec);
+
+    /* Remove every trace of a closed connection */
+    void reap_client(const con_session_t::ptr &session);
+    void reap_agent(const con_session_t::ptr &session);
+
+    /* Drop the subscriber entries of an agent that is gone */
+    void forget_agent(uint32_t guid);
+
+    /* Message Handler [bound per connection with its session] */
+    void on_message(const con_session_t::ptr &session, server_t::message_ptr message);
+
+    /* Encode and frame a message once, straight into a pooled buffer, so it can be shared by every recipient */
+    server_t::message_ptr prepare_message(const nlohmann::json &payload, Horus::Protocol::Encoding encoding);
+
+    /* Send a payload with the encoding of the receiving session */
+    void send(const con_session_t::ptr &session, const nlohmann::json &payload);
+    void send(con_hdl_t handle, const nlohmann::json &payload);
+
+    /* Broadcast message to clients [queued into the current batch when batching is enabled] */
+    void broadcast_to_clients(const nlohmann::json &message);
+
+    /* Publish an agent event to unfiltered clients and the subscribers of the agent */
+    void publish_agent_event(uint32_t guid, const nlohmann::json &message);
+
+    /* Send right away or queue into the current batch */
+    void queue_broadcast(broadcast_event_t event);
 
-    /* Broadcast message to clients */
-    void broadcast_to_clients(std::string message);
+    /* Deliver events to their recipients [one frame per client] */
+    void deliver_events(std::vector<broadcast_event_t> events);
+    void fan_out(const std::vector<broadcast_event_t> &events);
+
+    /* Send one frame to every client of an index [framed once per encoding in use, returns the frames sent] */
+    std::size_t send_to(const con_ready_index_t &recipients, const nlohmann::json &message);
+    bool send_frame(const con_session_t::ptr &recipient, const nlohmann::json &message, Horus::Protocol::MessageType message_type, std::array<server_t::message_ptr, 3> &frames);
+
+    /* Count a frame sent to a peer */
+    void count_outbound(channel_t channel, Horus::Protocol::MessageType message_type, std::size_t bytes);
+
+    /* Batch Timer Handler [sends the queued events as a single batch frame] */
+    void flush_broadcast_batch(const websocketpp::lib::error_code &ec);
+
+    /* Conflation Timer Handler [broadcasts the latest pending update of every agent] */
+    void flush_agent_updates(const websocketpp::lib::error_code &ec);
+
+    /* Slow Consumer Handling */
+    bool is_slow_consumer(const con_session_t::ptr &session);
+    void on_slow_consumer(const con_session_t::ptr &session, const nlohmann::json &message);
+    void drain_slow_consumer(const con_session_t::ptr &session, const websocketpp::lib::error_code &ec);
 
     /* Auth Message Handler */
-    void on_client_auth(con_hdl_t handle, nlohmann::json payload);
-    void on_agent_auth(con_hdl_t handle, nlohmann::json payload);
+    void on_client_auth(const con_session_t::ptr &session, const Horus::Protocol::AuthMessage &message);
+    void on_agent_auth(const con_session_t::ptr &session, const Horus::Protocol::AuthMessage &message);
 
     /* Ready Message Handler */
-    void on_client_ready(con_hdl_t handle, nlohmann::json payload);
-    void on_agent_ready(con_hdl_t handle, nlohmann::json payload);
+    void on_client_ready(const con_session_t::ptr &session, const Horus::Protocol::ReadyMessage &message);
+    void on_agent_ready(const con_session_t::ptr &session, const Horus::Protocol::ReadyMessage &message);
 
     /* Update Message Handler */
-    void on_update_by_client(con_hdl_t handle, nlohmann::json payload);
-    void on_update_name_by_client(con_hdl_t handle, nlohmann::json payload);
-    void on_update_state_by_client(con_hdl_t handle, nlohmann::json payload);
-    void on_update_by_agent(con_hdl_t handle, nlohmann::json payload);
+    void on_update_by_client(const con_session_t::ptr &session, const Horus::Protocol::UpdateMessage &message);
+    void on_update_name_by_client(const con_session_t::ptr &session, const Horus::Protocol::UpdateNameMessage &message);
+    void on_update_state_by_client(const con_session_t::ptr &session, const Horus::Protocol::UpdateStateMessage &message);
+    void on_update_by_agent(const con_session_t::ptr &session, const Horus::Protocol::UpdateMessage &message);
+
+    /* Metadata Serialization */
+    nlohmann::json metadata_to_json(const con_metadata_t &metadata);
+
+    /* Point a row at a new name [call inside the row update, the old name reference is dropped, returns false if unchanged] */
+    bool rename(con_metadata_t &metadata, const std::string &name);
+
+    /* Free the row of a guid and its name reference */
+    bool erase_metadata(uint32_t guid, con_metadata_t &removed);
+
+    /* Subscribe Message Handler [restricts the agents a client hears about] */
+    void on_client_subscribe(const con_session_t::ptr &session, const Horus::Protocol::SubscribeMessage &message);
+
+    /* Replace the subscription of a client and rebuild its index entries */
+    void set_subscription(const con_session_t::ptr &session, std::shared_ptr<const con_subscription_t> subscription);
+
+    /* Match an agent against every filtered client after it went ready or was renamed */
+    void refresh_agent_subscribers(uint32_t guid, const std::string &name);
+
+    /* Agent Subscribers Index Maintenance */
+    void add_subscriber(uint32_t guid, const con_session_t::ptr &session);
+    void remove_subscriber(uint32_t guid, const con_session_t::ptr &session);
+
+    /* Sync Message Handler [changes since a registry version] */
+    void on_client_sync(const con_session_t::ptr &session, const Horus::Protocol::SyncMessage &message);
+
+    /* Send every ready agent changed after since as one snapshot message */
+    void send_snapshot(const con_session_t::ptr &session, uint64_t since);
+
+    /* Typed Message Dispatch */
+    template <typename Message>
+    void dispatch(const con_session_t::ptr &session, const nlohmann::json &payload, void (Middleware::*handler)(const con_session_t::ptr &, const Message &));
 
     /* Client Message Handler */
-    void handle_client_message(std::string message_type, con_hdl_t handle, nlohmann::json payload);
+    void handle_client_message(Horus::Protocol::MessageType message_type, const con_session_t::ptr &session, const nlohmann::json &payload);
 
     /* Agent Message Handler */
-    void handle_agent_message(std::string message_type, con_hdl_t handle, nlohmann::json payload);
+    void handle_agent_message(Horus::Protocol::MessageType message_type, const con_session_t::ptr &session, const nlohmann::json &payload);
 
 private:
     /* Server Instance */
@@ -90,23 +510,101 @@ private:
     /* Conection ID Counter */
     uint32_t m_connection_id_counter;
 
-    /* Connections Buffer */
-    con_set_t m_connections;
-    con_set_t m_clients;
-    con_set_t m_agents;
-    con_metadata_map_t m_clients_metadata;
-    con_metadata_map_t m_agents_metadata;
-
-    /* Connection GUID */
-    uint32_t m_next_guid = 0;
+    /* Sessions Buffer [keyed by connection] */
+    con_session_map_t m_sessions;
+
+    /* Metadata Buffer [hands out the guids of agents and clients alike] */
+    con_metadata_map_t m_metadata;
+
+    /* Ready Clients [broadcast recipients, keyed by guid] */
+    con_ready_index_t m_ready_clients;
+
+    /* Ready clients split by subscription [firehose receives every agent, filtered only its matches] */
+    con_ready_index_t m_firehose_clients;
+    con_ready_index_t m_filtered_clients;
+    con_subscriber_map_t m_agent_subscribers;
+
+    /* Interned Connection Names */
+    Horus::NameTable m_names;
+
+    /* Registry Version [bumped by every agent change, stamped on the changed row] */
+    std::atomic<uint64_t> m_registry_version{0};
+
+    /* Conflated Agent Updates [latest payload per guid until the timer fires] */
+    std::chrono::milliseconds m_conflation_window{0};
+    std::mutex m_pending_lock;
+    std::unordered_map<uint32_t, pending_update_t> m_pending_updates;
+    server_t::timer_ptr m_flush_timer;
+    uint64_t m_conflated_updates = 0;
+
+    /* Broadcast Batch [events waiting for the next batch frame] */
+    std::chrono::milliseconds m_batch_interval{0};
+    std::size_t m_batch_max_events = 64;
+    std::mutex m_batch_lock;
+    std::vector<broadcast_event_t> m_batch;
+    server_t::timer_ptr m_batch_timer;
+
+    /* Slow Consumers */
+    std::size_t m_outbound_limit = 1024 * 1024;
+    slow_consumer_policy_t m_slow_consumer_policy = slow_consumer_policy_t::conflate;
+    std::atomic<uint64_t> m_slow_consumer_drops{0};
+    std::atomic<uint64_t> m_slow_consumer_conflations{0};
+    std::atomic<uint64_t> m_slow_consumer_disconnects{0};
+
+    /* Handshake Routes [exact paths, built once in the constructor] */
+    const route_table_t m_routes{
+        {"/agents", route_t{channel_t::agents, 1}},
+        {"/clients", route_t{channel_t::clients, 1}},
+        {"/v1/agents", route_t{channel_t::agents, 1}},
+        {"/v1/clients", route_t{channel_t::clients, 1}},
+    };
+
+    std::atomic<uint64_t> m_handshakes_accepted{0};
+    std::atomic<uint64_t> m_handshakes_rejected{0};
+
+    /* Heartbeat */
+    std::chrono::milliseconds m_heartbeat_interval{10000};
+    std::chrono::milliseconds m_heartbeat_timeout{30000};
+    std::mutex m_heartbeat_lock;
+    server_t::timer_ptr m_heartbeat_timer;
+    std::atomic<uint64_t> m_heartbeat_timeouts{0};
+    std::atomic<uint64_t> m_agents_gone{0};
+
+    /* Tombstones [registry version and guid of gone agents, so a sync can report them] */
+    std::mutex m_tombstone_lock;
+    std::deque<std::pair<uint64_t, uint32_t>> m_tombstones;
+    uint64_t m_tombstone_floor = 0;
+    static constexpr std::size_t m_tombstone_limit = 4096;
+
+    /* Drain Retry Interval [ms between outbound buffer checks of a conflating client] */
+    static constexpr long m_drain_interval = 20;
+
+    /* Endpoint Tuning */
+    Horus::Server::Tuning m_tuning;
+
+    /* Latency Histograms [always on, per thread buckets] */
+    latency_histograms_t m_latency;
+
+    /* Metrics [sharded counters, indexed by channel or message type] */
+    std::array<Horus::Metrics::Gauge, 3> m_connections;
+    std::array<Horus::Metrics::Counter, 3> m_bytes_in;
+    std::array<Horus::Metrics::Counter, 3> m_bytes_out;
+    std::array<Horus::Metrics::Counter, Horus::Protocol::message_type_count> m_messages_in;
+    std::array<Horus::Metrics::Counter, Horus::Protocol::message_type_count> m_messages_out;
+    fan_out_buckets_t m_fan_out_sizes{{0, 1, 4, 16, 64, 256, 1024, 4096, 16384}};
+
+    /* Arrival of the frame the calling thread is handling [steady ns, zero outside on_message] */
+    static thread_local int64_t m_received;
 
     /* Server Port */
     uint16_t m_port = 9002;
 
-    /* Server Thread */
-    std::thread m_server_thread;
+    /* Server Threads */
+    std::vector<std::thread> m_server_threads;
 };
 
+thread_local int64_t Middleware::m_received = 0;
+
 Middleware::Middleware()
 {
     H_PROFILE_FUNCTION();
@@ -124,7 +622,8 @@ Middleware::Middleware()
     m_server.set_validate_handler(std::bind(&Middleware::validate, this, std::placeholders::_1));
     m_server.set_open_handler(std::bind(&Middleware::on_open, this, std::placeholders::_1));
     m_server.set_close_handler(std::bind(&Middleware::on_close, this, std::placeholders::_1));
-    m_server.set_message_handler(std::bind(&Middleware::on_message, this, std::placeholders::_1, std::placeholders::_2));
+    m_server.set_socket_init_handler(std::bind(&Middleware::on_socket_init, this, std::placeholders::_1, std::placeholders::_2));
+    m_server.set_http_handler(std::bind(&Middleware::on_http, this, std::placeholders::_1));
 }
 
 Middleware::~Middleware()
@@ -133,24 +632,53 @@ Middleware::~Middleware()
 }
 
 /* Middleware Run */
-void Middleware::run(uint16_t port)
+void Middleware::run(uint16_t port, uint32_t threads)
 {
     H_PROFILE_FUNCTION();
 
     m_port = port;
+    threads = std::max<uint32_t>(threads, 1);
+
+    /* Endpoint Limits */
+    m_server.set_max_message_size(m_tuning.max_message_size);
+    m_server.set_open_handshake_timeout(m_tuning.open_handshake_timeout);
+    m_server.set_close_handshake_timeout(m_tuning.close_handshake_timeout);
 
-    /* Socket Setup */
+    /* Socket Setup [reuse the port right after a restart, queue reconnect storms in the backlog] */
+    m_server.set_reuse_addr(true);
+    m_server.set_listen_backlog(m_tuning.listen_backlog);
     m_server.listen(m_port);
+
+    /* Keep the port actually bound */
+    websocketpp::lib::asio::error_code endpoint_ec;
+    websocketpp::lib::asio::ip::tcp::endpoint endpoint = m_server.get_local_endpoint(endpoint_ec);
+
+    if (!endpoint_ec)
+        m_port = endpoint.port();
+
     H_DEBUG("[SERVER] Listening on port {}", m_port);
 
     /* Accept Connections */
     m_server.start_accept();
     H_DEBUG("[SERVER] Ready to accept connections");
 
-    /* Start Middleware Thread */
-    m_server_thread = std::thread([&]() { m_server.run(); });
+    /* Heartbeat */
+    if (m_heartbeat_interval.count() > 0)
+    {
+        std::lock_guard<std::mutex> lock(m_heartbeat_lock);
+        m_heartbeat_timer = m_server.set_timer(m_heartbeat_interval.count(), std::bind(&Middleware::heartbeat, this, std::placeholders::_1));
+    }
+
+    /* Start Middleware Threads
+     *
+     * Every worker runs the same io_service, the asio transport wraps the
+     * handlers of each connection in its own strand (enable_multithreading),
+     * so a connection is never handled by two workers at the same time.
+     */
+    for (uint32_t i = 0; i < threads; ++i)
+        m_server_threads.emplace_back([&]() { m_server.run(); });
 
-    H_DEBUG("[SERVER] Running");
+    H_DEBUG("[SERVER] Running with {} thread(s)", threads);
 }
 
 /* Middleware Stop */
@@ -161,14 +689,57 @@ void Middleware::stop()
     H_DEBUG("[SERVER] Terminating");
     m_server.stop_listening();
 
-    con_set_t::iterator con_it;
-    for (con_it = m_connections.begin(); con_it != m_connections.end(); ++con_it)
     {
-        m_server.pause_reading(*con_it);
-        m_server.close(*con_it, websocketpp::close::status::normal, "server closed");
+        std::lock_guard<std::mutex> lock(m_heartbeat_lock);
+
+        if (m_heartbeat_timer)
+            m_heartbeat_timer->cancel();
+
+        m_heartbeat_timer.reset();
+    }
+
+    /* Pending updates are dropped, their recipients are about to be closed */
+    {
+        std::lock_guard<std::mutex> lock(m_pending_lock);
+
+        if (m_flush_timer)
+            m_flush_timer->cancel();
+
+        m_flush_timer.reset();
+        m_pending_updates.clear();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_batch_lock);
+
+        if (m_batch_timer)
+            m_batch_timer->cancel();
+
+        m_batch_timer.reset();
+        m_batch.clear();
+    }
+
+    /* Closing triggers on_close on the workers, so work on a copy */
+    std::vector<con_session_t::ptr> sessions = m_sessions.values();
+
+    for (con_session_t::ptr &session : sessions)
+    {
+        {
+            std::lock_guard<std::mutex> lock(session->outbound_lock);
+
+            if (session->drain_timer)
+                session->drain_timer->cancel();
+
+            session->drain_timer.reset();
+        }
+
+        m_server.pause_reading(session->handle);
+        m_server.close(session->handle, websocketpp::close::status::normal, "server closed");
     }
 
-    m_server_thread.join();
+    for (std::thread &server_thread : m_server_threads)
+        server_thread.join();
+    m_server_threads.clear();
     H_DEBUG("[SERVER] Stopped");
 }
 
@@ -179,403 +750,1471 @@ bool Middleware::validate(con_hdl_t handle)
 
     server_t::connection_ptr con = m_server.get_con_from_hdl(handle);
 
-    std::string res = con->get_resource();
-    std::regex channel_regex("(/agents|/clients)", std::regex_constants::ECMAScript);
+    route_t route;
 
-    if (!std::regex_search(res, channel_regex))
+    if (!m_routes.match(con->get_resource(), route))
     {
+        m_handshakes_rejected++;
         con->set_status(websocketpp::http::status_code::not_acceptable, "invalid channel");
-        H_DEBUG("[HANDSHAKE] [REJECT] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+        H_DEBUG("[HANDSHAKE] [REJECT] host => [{}] resource => [{}]", con->get_host(), con->get_resource());
         return false;
     }
 
-    H_DEBUG("[HANDSHAKE] [ACCEPT] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+    /* Encoding Negotiation [first subprotocol we understand, JSON text when none is requested] */
+    Horus::Protocol::Encoding encoding = Horus::Protocol::Encoding::json;
+
+    for (const std::string &subprotocol : con->get_requested_subprotocols())
+    {
+        if (!Horus::Protocol::encoding_from_subprotocol(subprotocol, encoding))
+            continue;
+
+        websocketpp::lib::error_code ec;
+        con->select_subprotocol(subprotocol, ec);
+
+        if (ec)
+        {
+            H_ERROR("[HANDSHAKE] [SUBPROTOCOL] host => [{}] {}", con->get_host(), ec.message());
+            encoding = Horus::Protocol::Encoding::json;
+            continue;
+        }
+
+        break;
+    }
+
+    m_handshakes_accepted++;
+    H_DEBUG("[HANDSHAKE] [ACCEPT] host => [{}] channel => [{}] version => [{}] encoding => [{}]", con->get_host(), channel_name(route.channel), route.version, Horus::Protocol::to_string(encoding));
     return true;
 }
 
-/* Connection Open Handler */
-void Middleware::on_open(con_hdl_t handle)
+/* HTTP Handler */
+void Middleware::on_http(con_hdl_t handle)
 {
     H_PROFILE_FUNCTION();
 
     server_t::connection_ptr con = m_server.get_con_from_hdl(handle);
-    std::string res = con->get_resource();
 
-    m_connections.insert(handle);
+    if (route_table_t::path_of(con->get_resource()) != "/metrics")
+    {
+        con->set_status(websocketpp::http::status_code::not_found);
+        H_DEBUG("[HTTP] [NOT_FOUND] host => [{}] resource => [{}]", con->get_host(), con->get_resource());
+        return;
+    }
+
+    con->set_body(render_metrics());
+    con->append_header("Content-Type", Horus::Metrics::Exposition::content_type);
+    con->set_status(websocketpp::http::status_code::ok);
+}
+
+/* Socket Init Handler */
+void Middleware::on_socket_init(con_hdl_t handle, websocketpp::lib::asio::ip::tcp::socket &socket)
+{
+    if (!m_tuning.tcp_nodelay)
+        return;
 
-    if (res.substr(1) == "clients")
-        m_clients.insert(handle);
-    else if (res.substr(1) == "agents")
-        m_agents.insert(handle);
+    websocketpp::lib::asio::error_code ec;
+    socket.set_option(websocketpp::lib::asio::ip::tcp::no_delay(true), ec);
 
-    H_DEBUG("[CONNECTION] [OPEN] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+    if (ec)
+        H_DEBUG("[SOCKET] [NODELAY] [FAILED] {}", ec.message());
 }
 
-/* Connection Close Handler */
-void Middleware::on_close(con_hdl_t handle)
+/* Connection Open Handler */
+void Middleware::on_open(con_hdl_t handle)
 {
     H_PROFILE_FUNCTION();
 
     server_t::connection_ptr con = m_server.get_con_from_hdl(handle);
-    std::string res = con->get_resource();
 
-    m_connections.erase(handle);
+    /* Validated already, the lookup cannot miss */
+    route_t route;
+    m_routes.match(con->get_resource(), route);
 
-    if (res.substr(1) == "clients")
-        m_clients.erase(handle);
-    else if (res.substr(1) == "agents")
-        m_agents.erase(handle);
+    con_session_t::ptr session(new con_session_t(route.channel, con->get_host(), handle, con));
+    Horus::Protocol::encoding_from_subprotocol(con->get_subprotocol(), session->encoding);
+    m_sessions.insert(con_key(handle), session);
 
-    H_DEBUG("[CONNECTION] [CLOSE] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+    /* Frames and pongs arrive with their session, no lookup per message */
+    con->set_message_handler(std::bind(&Middleware::on_message, this, session, std::placeholders::_2));
+    con->set_pong_handler(std::bind(&Middleware::on_pong, this, session, std::placeholders::_2));
+    m_connections[static_cast<std::size_t>(session->channel)].add();
+
+    H_DEBUG("[CONNECTION] [OPEN] host => [{}] channel => [{}] encoding => [{}]", session->host, channel_name(session->channel), Horus::Protocol::to_string(session->encoding));
 }
 
-/* Message Handler */
-void Middleware::on_message(con_hdl_t handle, server_t::message_ptr message)
+/* Connection Close Handler */
+void Middleware::on_close(con_hdl_t handle)
 {
     H_PROFILE_FUNCTION();
 
-    server_t::connection_ptr con = m_server.get_con_from_hdl(handle);
-    std::string res = con->get_resource();
+    con_key_t key = con_key(handle);
+    con_session_t::ptr session;
 
-    // con_set_t::iterator con_it;
-    // for (con_it = m_connections.begin(); con_it != m_connections.end(); ++con_it)
-    //     m_server.send(*con_it, message);
+    if (!m_sessions.find(key, session))
+        return;
 
-    nlohmann::json payload;
+    m_sessions.erase(key);
+    m_connections[static_cast<std::size_t>(session->channel)].sub();
 
-    std::string message_type = "invalid";
+    /* The handlers hold the session and the session holds the connection, break the cycle */
+    session->connection->set_message_handler(server_t::message_handler());
+    session->connection->set_pong_handler(websocketpp::pong_handler());
 
-    try
+    if (session->authenticated)
     {
-        payload = nlohmann::json::parse(message->get_payload());
-        message_type = payload.at("message_type").get<std::string>();
+        if (session->channel == channel_t::clients)
+            reap_client(session);
+        else
+            reap_agent(session);
     }
-    catch (const std::exception &e)
-    {
-        H_ERROR("[MESSAGE] [MISSING_MESSAGE_TYPE] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
-    }
-
-    if (res.substr(1) == "clients")
-        handle_client_message(message_type, handle, payload);
-    else if (res.substr(1) == "agents")
-        handle_agent_message(message_type, handle, payload);
-
-    // if (res.substr(1) == "clients")
-    //     for (con_it = m_agents.begin(); con_it != m_agents.end(); ++con_it)
-    //         m_server.send(*con_it, message);
-    // else if (res.substr(1) == "agents")
-    //     for (con_it = m_clients.begin(); con_it != m_clients.end(); ++con_it)
-    //         m_server.send(*con_it, message);
 
-    // H_DEBUG("[MESSAGE] host => [{}] channel => [{}] message => [{}]", con->get_host(), res.substr(1), message->get_payload());
+    H_DEBUG("[CONNECTION] [CLOSE] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
 }
 
-void Middleware::broadcast_to_clients(std::string message)
+void Middleware::reap_client(const con_session_t::ptr &session)
 {
-    con_metadata_map_t::iterator con_it;
-    for (con_it = m_clients_metadata.begin(); con_it != m_clients_metadata.end(); ++con_it)
-    {
-        if (con_it->second->status != "ready")
-        {
-            H_DEBUG("[BROADCAST] [SKIP] [{}] [{}]", con_it->second->name, con_it->second->status);
-            continue;
-        }
+    m_ready_clients.erase(session->guid);
+    m_firehose_clients.erase(session->guid);
+    m_filtered_clients.erase(session->guid);
 
-        // con_hdl_t handle = con_it->second->handle;
-        H_DEBUG("[BROADCAST] [SENT] [{}] [{}]", con_it->second->name, con_it->second->status);
-        m_server.send(con_it->second->handle, message, websocketpp::frame::opcode::text);
-    }
-}
+    con_metadata_t metadata;
+    erase_metadata(session->guid, metadata);
 
-void Middleware::on_client_auth(con_hdl_t handle, nlohmann::json payload)
-{
-    uint32_t guid = m_next_guid++;
+    std::lock_guard<std::mutex> lock(session->subscription_lock);
 
-    server_t::connection_ptr con = m_server.get_con_from_hdl(handle);
-    std::string res = con->get_resource();
+    for (uint32_t agent : session->subscribed_agents)
+        remove_subscriber(agent, session);
 
-    con_metadata_t::ptr metadata(new con_metadata_t("open", false, "no_name", guid, handle));
-    m_clients_metadata[guid] = metadata;
-    H_DEBUG("[CLIENT] [AUTH] host => [{}] channel => [{}] => [{}]", con->get_host(), res.substr(1), nlohmann::json({{"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
-    m_server.send(handle, nlohmann::json({{"message_type", "ready"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump(), websocketpp::frame::opcode::text);
+    session->subscribed_agents.clear();
 }
 
-void Middleware::on_agent_auth(con_hdl_t handle, nlohmann::json payload)
+void Middleware::reap_agent(const con_session_t::ptr &session)
 {
-    uint32_t guid = m_next_guid++;
-
-    server_t::connection_ptr con = m_server.get_con_from_hdl(handle);
-    std::string res = con->get_resource();
-
-    con_metadata_t::ptr metadata(new con_metadata_t("open", false, "no_name", guid, handle));
-    m_agents_metadata[guid] = metadata;
-    H_DEBUG("[AGENT] [AUTH] host => [{}] channel => [{}] => [{}]", con->get_host(), res.substr(1), nlohmann::json({{"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
-    m_server.send(handle, nlohmann::json({{"message_type", "ready"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump(), websocketpp::frame::opcode::text);
-}
+    H_PROFILE_FUNCTION();
 
-void Middleware::on_client_ready(con_hdl_t handle, nlohmann::json payload)
-{
-    server_t::connection_ptr con = m_server.get_con_from_hdl(handle);
-    std::string res = con->get_resource();
+    con_metadata_t metadata;
 
-    uint32_t guid = 0;
-    std::string name = "invalid";
-    bool state = false;
+    if (!erase_metadata(session->guid, metadata))
+        return;
 
-    try
+    /* A conflated update flushed after this point would bring the agent back */
     {
-        ;
-        guid = payload.at("guid").get<uint32_t>();
-        name = payload.at("name").get<std::string>();
-        state = payload.at("state").get<bool>();
+        std::lock_guard<std::mutex> lock(m_pending_lock);
+        m_pending_updates.erase(session->guid);
     }
-    catch (const std::exception &e)
+
+    /* Agents that never went ready were never announced */
+    if (metadata.status == Horus::Status::open)
     {
-        H_ERROR("[CLIENT] [READY] [MISSING_GUID] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+        forget_agent(session->guid);
         return;
     }
 
-    con_metadata_t::ptr metadata = m_clients_metadata[guid];
+    uint64_t version = ++m_registry_version;
 
-    if (!metadata)
     {
-        H_ERROR("[AGENT] [READY] [NOT_AUTHORIZED] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
-        return;
-    }
+        std::lock_guard<std::mutex> lock(m_tombstone_lock);
 
-    if (metadata->status != "open")
-        return;
+        m_tombstones.emplace_back(version, session->guid);
+
+        if (m_tombstones.size() > m_tombstone_limit)
+        {
+            m_tombstone_floor = m_tombstones.front().first;
+            m_tombstones.pop_front();
+        }
+    }
 
-    metadata->status = "ready";
-    metadata->state = state;
-    metadata->name = name;
-    m_clients_metadata[guid] = metadata;
-    H_DEBUG("[CLIENT] [READY] host => [{}] channel => [{}] => [{}]", con->get_host(), res.substr(1), nlohmann::json({{"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
-    m_server.send(handle, nlohmann::json({{"message_type", "ready"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump(), websocketpp::frame::opcode::text);
+    m_agents_gone++;
+    H_DEBUG("[AGENT] [GONE] host => [{}] guid => [{}] version => [{}]", session->host, session->guid, version);
 
-    /* Notify all clients */
-    broadcast_to_clients(nlohmann::json({{"message_type", "new_client"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
+    /* Notify interested clients */
+    queue_broadcast(broadcast_event_t{true, session->guid, nlohmann::json({{"message_type", "agent_gone"}, {"guid", session->guid}, {"version", version}}), true});
 }
 
-void Middleware::on_agent_ready(con_hdl_t handle, nlohmann::json payload)
+void Middleware::forget_agent(uint32_t guid)
 {
-    server_t::connection_ptr con = m_server.get_con_from_hdl(handle);
-    std::string res = con->get_resource();
-
-    uint32_t guid = 0;
-    std::string name = "invalid";
-    bool state = false;
+    std::vector<con_session_t::ptr> subscribers;
 
-    try
-    {
-        guid = payload.at("guid").get<uint32_t>();
-        name = payload.at("name").get<std::string>();
-        state = payload.at("state").get<bool>();
-    }
-    catch (const std::exception &e)
-    {
-        H_ERROR("[AGENT] [READY] [MISSING_GUID|MISSING_NAME|MISSING_STATE] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+    if (!m_agent_subscribers.find(guid, subscribers))
         return;
-    }
 
-    con_metadata_t::ptr metadata = m_agents_metadata[guid];
+    m_agent_subscribers.erase(guid);
 
-    if (!metadata)
+    for (const con_session_t::ptr &subscriber : subscribers)
     {
-        H_ERROR("[AGENT] [READY] [NOT_AUTHORIZED] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
-        return;
+        std::lock_guard<std::mutex> lock(subscriber->subscription_lock);
+        subscriber->subscribed_agents.erase(guid);
     }
-
-    if (metadata->status != "open")
-        return;
-
-    metadata->status = "ready";
-    metadata->state = state;
-    metadata->name = name;
-    m_clients_metadata[guid] = metadata;
-    H_DEBUG("[AGENT] [READY] host => [{}] channel => [{}] => [{}]", con->get_host(), res.substr(1), nlohmann::json({{"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
-    m_server.send(handle, nlohmann::json({{"message_type", "ready"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump(), websocketpp::frame::opcode::text);
-
-    /* Notify all clients */
-    broadcast_to_clients(nlohmann::json({{"message_type", "new_agent"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
 }
 
-void Middleware::on_update_by_client(con_hdl_t handle, nlohmann::json payload)
+void Middleware::on_pong(const con_session_t::ptr &session, std::string payload)
 {
-    server_t::connection_ptr con = m_server.get_con_from_hdl(handle);
-    std::string res = con->get_resource();
+    session->last_seen = steady_ms();
+}
 
-    uint32_t guid = 0;
-    std::string name = "invalid";
-    std::string status = "open";
-    bool state = false;
+void Middleware::heartbeat(const websocketpp::lib::error_code &ec)
+{
+    H_PROFILE_FUNCTION();
 
-    try
-    {
-        guid = payload.at("guid").get<uint32_t>();
-        name = payload.at("name").get<std::string>();
-        status = payload.at("status").get<std::string>();
-        state = payload.at("state").get<bool>();
-    }
-    catch (const std::exception &e)
-    {
-        H_ERROR("[CLIENT] [READY] [MISSING_GUID] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+    if (ec)
         return;
-    }
 
-    con_metadata_t::ptr metadata = m_clients_metadata[guid];
+    int64_t now = steady_ms();
 
-    if (!metadata)
+    /* Closing triggers on_close on the workers, so work on a copy */
+    std::vector<con_session_t::ptr> sessions = m_sessions.values();
+
+    for (const con_session_t::ptr &session : sessions)
+    {
+        int64_t silent = now - session->last_seen;
+
+        if (session->closing)
+            continue;
+
+        /* Dead peers never answer the close handshake either, its timeout ends the connection */
+        if (silent > m_heartbeat_timeout.count())
+        {
+            session->closing = true;
+            m_heartbeat_timeouts++;
+            H_DEBUG("[HEARTBEAT] [TIMEOUT] host => [{}] channel => [{}] silent => [{}ms]", session->host, channel_name(session->channel), silent);
+
+            websocketpp::lib::error_code close_ec;
+            m_server.close(session->handle, websocketpp::close::status::going_away, "heartbeat timeout", close_ec);
+            continue;
+        }
+
+        /* Recent traffic already proves the peer is alive */
+        if (silent < m_heartbeat_interval.count())
+            continue;
+
+        websocketpp::lib::error_code ping_ec;
+        m_server.ping(session->handle, "", ping_ec);
+    }
+
+    std::lock_guard<std::mutex> lock(m_heartbeat_lock);
+
+    if (m_heartbeat_timer)
+        m_heartbeat_timer = m_server.set_timer(m_heartbeat_interval.count(), std::bind(&Middleware::heartbeat, this, std::placeholders::_1));
+}
+
+/* Message Handler */
+void Middleware::on_message(const con_session_t::ptr &session, server_t::message_ptr message)
+{
+    H_PROFILE_FUNCTION();
+
+    int64_t received = steady_ns();
+
+    session->messages_in++;
+    session->bytes_in += message->get_payload().size();
+    session->last_seen = received / 1000000;
+
+    /* Text frames are always JSON, binary frames use the negotiated encoding */
+    Horus::Protocol::Encoding encoding = message->get_opcode() == websocketpp::frame::opcode::text ? Horus::Protocol::Encoding::json : session->encoding;
+
+    nlohmann::json payload = Horus::Protocol::parse(message->get_payload(), encoding);
+    Horus::Protocol::MessageType message_type = Horus::Protocol::message_type_of(payload);
+
+    int64_t parsed = steady_ns();
+    record_latency(message_type, latency_stage_t::parse, parsed - received);
+
+    m_messages_in[static_cast<std::size_t>(message_type)].add();
+    m_bytes_in[static_cast<std::size_t>(session->channel)].add(message->get_payload().size());
+
+    if (payload.is_discarded())
+    {
+        H_ERROR("[MESSAGE] [MALFORMED] host => [{}] channel => [{}] encoding => [{}]", session->host, channel_name(session->channel), Horus::Protocol::to_string(encoding));
+        return;
+    }
+
+    if (message_type == Horus::Protocol::MessageType::invalid)
     {
-        H_ERROR("[CLIENT] [UPDATE] [NOT_AUTHORIZED] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+        H_ERROR("[MESSAGE] [MISSING_MESSAGE_TYPE] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
         return;
     }
 
-    metadata->status = status;
-    metadata->state = state;
-    metadata->name = name;
-    m_clients_metadata[guid] = metadata;
-    H_DEBUG("[CLIENT] [UPDATE] host => [{}] channel => [{}] => [{}]", con->get_host(), res.substr(1), nlohmann::json({{"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
-    m_server.send(metadata->handle, nlohmann::json({{"message_type", "update_agent"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump(), websocketpp::frame::opcode::text);
+    /* Events raised while handling carry the arrival of this frame */
+    m_received = received;
 
-    /* Notify all clients */
-    // broadcast_to_clients(nlohmann::json({{"message_type", "new_client"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
+    switch (session->channel)
+    {
+    case channel_t::clients:
+        handle_client_message(message_type, session, payload);
+        break;
+    case channel_t::agents:
+        handle_agent_message(message_type, session, payload);
+        break;
+    default:
+        break;
+    }
+
+    m_received = 0;
+
+    record_latency(message_type, latency_stage_t::handle, steady_ns() - parsed);
+
+    // H_DEBUG("[MESSAGE] host => [{}] channel => [{}] message => [{}]", session->host, channel_name(session->channel), message->get_payload());
 }
 
-void Middleware::on_update_name_by_client(con_hdl_t handle, nlohmann::json payload)
+server_t::message_ptr Middleware::prepare_message(const nlohmann::json &payload, Horus::Protocol::Encoding encoding)
 {
-    server_t::connection_ptr con = m_server.get_con_from_hdl(handle);
-    std::string res = con->get_resource();
+    websocketpp::frame::opcode::value opcode = opcode_for(encoding);
+    server_t::message_ptr message = server_t::message_type::con_msg_man_type::acquire(opcode, 0);
+
+    std::string &raw = message->get_raw_payload();
+    Horus::Protocol::encode_into(payload, encoding, raw);
+
+#ifdef ENABLE_PERMESSAGE_DEFLATE
+    /* Compression state is per connection, leave framing to each connection so it can deflate */
+    message->set_compressed(true);
+#else
+    /* Server frames are never masked, so the same header and payload are valid on every connection */
+    websocketpp::frame::basic_header header(opcode, raw.size(), true, false);
+    websocketpp::frame::extended_header extended_header(raw.size());
+    message->set_header(websocketpp::frame::prepare_header(header, extended_header));
+
+    /* Prepared messages are queued as they are instead of being copied and framed per connection */
+    message->set_prepared(true);
+#endif
+
+    return message;
+}
 
-    uint32_t guid = 0;
-    std::string name = "invalid";
+void Middleware::send(const con_session_t::ptr &session, const nlohmann::json &payload)
+{
+    server_t::message_ptr message = prepare_message(payload, session->encoding);
+
+    websocketpp::lib::error_code ec = session->connection->send(message);
+
+    if (ec)
+    {
+        H_DEBUG("[SEND] [FAILED] host => [{}] channel => [{}] {}", session->host, channel_name(session->channel), ec.message());
+        return;
+    }
+
+    count_outbound(session->channel, Horus::Protocol::message_type_of(payload), message->get_payload().size());
+}
+
+void Middleware::send(con_hdl_t handle, const nlohmann::json &payload)
+{
+    con_session_t::ptr session;
+
+    if (!m_sessions.find(con_key(handle), session))
+        return;
+
+    send(session, payload);
+}
+
+void Middleware::broadcast_to_clients(const nlohmann::json &message)
+{
+    queue_broadcast(broadcast_event_t{false, 0, message});
+}
+
+void Middleware::publish_agent_event(uint32_t guid, const nlohmann::json &message)
+{
+    queue_broadcast(broadcast_event_t{true, guid, message});
+}
+
+void Middleware::queue_broadcast(broadcast_event_t event)
+{
+    std::vector<broadcast_event_t> events;
+
+    if (event.received == 0)
+        event.received = m_received;
 
-    try
+    if (m_batch_interval.count() == 0)
     {
-        guid = payload.at("guid").get<uint32_t>();
-        name = payload.at("name").get<std::string>();
+        events.push_back(std::move(event));
+        deliver_events(std::move(events));
+        return;
     }
-    catch (const std::exception &e)
+
     {
-        H_ERROR("[CLIENT] [READY] [MISSING_NAME|MISSING_GUID] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+        std::lock_guard<std::mutex> lock(m_batch_lock);
+
+        m_batch.push_back(std::move(event));
+
+        if (m_batch.size() < m_batch_max_events)
+        {
+            if (!m_batch_timer)
+                m_batch_timer = m_server.set_timer(m_batch_interval.count(), std::bind(&Middleware::flush_broadcast_batch, this, std::placeholders::_1));
+            return;
+        }
+
+        /* Size cap reached, send right away and let the armed timer find an empty batch */
+        events.swap(m_batch);
+    }
+
+    deliver_events(std::move(events));
+}
+
+void Middleware::flush_broadcast_batch(const websocketpp::lib::error_code &ec)
+{
+    H_PROFILE_FUNCTION();
+
+    if (ec)
         return;
+
+    std::vector<broadcast_event_t> events;
+
+    {
+        std::lock_guard<std::mutex> lock(m_batch_lock);
+        events.swap(m_batch);
+        m_batch_timer.reset();
     }
 
-    con_metadata_t::ptr metadata = m_clients_metadata[guid];
+    if (events.empty())
+        return;
+
+    H_DEBUG("[BATCH] [FLUSH] events => [{}]", events.size());
+
+    deliver_events(std::move(events));
+}
+
+void Middleware::deliver_events(std::vector<broadcast_event_t> events)
+{
+    int64_t start = steady_ns();
+
+    fan_out(events);
 
-    if (!metadata)
+    int64_t delivered = steady_ns();
+
+    /* A batch is timed as one delivery, end to end is still per event */
+    if (events.size() == 1)
+        record_latency(Horus::Protocol::message_type_of(events.front().message), latency_stage_t::fan_out, delivered - start);
+    else
+        record_latency(Horus::Protocol::MessageType::batch, latency_stage_t::fan_out, delivered - start);
+
+    for (const broadcast_event_t &event : events)
     {
-        H_ERROR("[CLIENT] [UPDATE] [NOT_AUTHORIZED] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+        if (event.received)
+            record_latency(Horus::Protocol::message_type_of(event.message), latency_stage_t::end_to_end, delivered - event.received);
+
+        if (event.retire)
+            forget_agent(event.agent_guid);
+    }
+}
+
+void Middleware::fan_out(const std::vector<broadcast_event_t> &events)
+{
+    H_PROFILE_FUNCTION();
+
+    for (const broadcast_event_t &event : events)
+        H_PROFILE_FLOW_STEP("update_agent", Horus::Protocol::trace_of(event.message));
+
+    std::size_t recipients = 0;
+
+    /* A lone event goes out as itself and its frames are shared by every recipient */
+    if (events.size() == 1)
+    {
+        const broadcast_event_t &event = events.front();
+        recipients += send_to(m_firehose_clients, event.message);
+
+        if (!event.agent_event)
+        {
+            recipients += send_to(m_filtered_clients, event.message);
+            m_fan_out_sizes.observe(recipients);
+            return;
+        }
+
+        std::vector<con_session_t::ptr> subscribers;
+        if (m_agent_subscribers.find(event.agent_guid, subscribers))
+        {
+            Horus::Protocol::MessageType message_type = Horus::Protocol::message_type_of(event.message);
+
+            std::array<server_t::message_ptr, 3> frames;
+            for (const con_session_t::ptr &subscriber : subscribers)
+                recipients += send_frame(subscriber, event.message, message_type, frames);
+        }
+
+        m_fan_out_sizes.observe(recipients);
         return;
     }
 
-    metadata->name = name;
-    m_clients_metadata[guid] = metadata;
-    H_DEBUG("[CLIENT] [UPDATE] host => [{}] channel => [{}] => [{}]", con->get_host(), res.substr(1), nlohmann::json({{"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
-    m_server.send(metadata->handle, nlohmann::json({{"message_type", "update_agent"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump(), websocketpp::frame::opcode::text);
+    nlohmann::json messages = nlohmann::json::array();
+    for (const broadcast_event_t &event : events)
+        messages.push_back(event.message);
 
-    /* Notify all clients */
-    // broadcast_to_clients(nlohmann::json({{"message_type", "new_client"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
+    recipients += send_to(m_firehose_clients, Horus::Protocol::make_batch(std::move(messages)));
+
+    /* Filtered clients get their own batch with the events they match */
+    m_filtered_clients.for_each([&](uint32_t guid, const con_session_t::ptr &recipient) {
+        nlohmann::json matched = nlohmann::json::array();
+
+        {
+            std::lock_guard<std::mutex> lock(recipient->subscription_lock);
+
+            for (const broadcast_event_t &event : events)
+                if (!event.agent_event || recipient->subscribed_agents.count(event.agent_guid))
+                    matched.push_back(event.message);
+        }
+
+        if (matched.empty())
+            return;
+
+        std::array<server_t::message_ptr, 3> frames;
+
+        if (matched.size() == 1)
+            recipients += send_frame(recipient, matched[0], Horus::Protocol::message_type_of(matched[0]), frames);
+        else
+            recipients += send_frame(recipient, Horus::Protocol::make_batch(std::move(matched)), Horus::Protocol::MessageType::batch, frames);
+    });
+
+    m_fan_out_sizes.observe(recipients);
 }
 
-void Middleware::on_update_state_by_client(con_hdl_t handle, nlohmann::json payload)
+std::size_t Middleware::send_to(const con_ready_index_t &recipients, const nlohmann::json &message)
 {
-    server_t::connection_ptr con = m_server.get_con_from_hdl(handle);
-    std::string res = con->get_resource();
+    Horus::Protocol::MessageType message_type = Horus::Protocol::message_type_of(message);
+    std::size_t sent = 0;
 
-    uint32_t guid = 0;
-    bool state = false;
+    /* Each encoding is serialized and framed at most once per broadcast */
+    std::array<server_t::message_ptr, 3> frames;
 
-    try
+    recipients.for_each([&](uint32_t guid, const con_session_t::ptr &recipient) {
+        sent += send_frame(recipient, message, message_type, frames);
+    });
+
+    return sent;
+}
+
+bool Middleware::send_frame(const con_session_t::ptr &recipient, const nlohmann::json &message, Horus::Protocol::MessageType message_type, std::array<server_t::message_ptr, 3> &frames)
+{
+    if (is_slow_consumer(recipient))
     {
-        guid = payload.at("guid").get<uint32_t>();
-        state = payload.at("state").get<bool>();
+        on_slow_consumer(recipient, message);
+        return false;
     }
-    catch (const std::exception &e)
+
+    server_t::message_ptr &frame = frames[static_cast<std::size_t>(recipient->encoding)];
+
+    if (!frame)
+        frame = prepare_message(message, recipient->encoding);
+
+    websocketpp::lib::error_code ec = recipient->connection->send(frame);
+
+    if (ec)
     {
-        H_ERROR("[CLIENT] [READY] [MISSING_NAME|MISSING_GUID] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+        H_DEBUG("[BROADCAST] [FAILED] [{}] {}", recipient->guid, ec.message());
+        return false;
+    }
+
+    count_outbound(recipient->channel, message_type, frame->get_payload().size());
+
+    H_DEBUG("[BROADCAST] [SENT] [{}]", recipient->guid);
+    return true;
+}
+
+void Middleware::count_outbound(channel_t channel, Horus::Protocol::MessageType message_type, std::size_t bytes)
+{
+    m_messages_out[static_cast<std::size_t>(message_type)].add();
+    m_bytes_out[static_cast<std::size_t>(channel)].add(bytes);
+}
+
+bool Middleware::is_slow_consumer(const con_session_t::ptr &session)
+{
+    if (m_outbound_limit == 0)
+        return false;
+
+    /* Once held back, later broadcasts queue behind the pending ones to keep their order */
+    if (session->conflating || session->closing)
+        return true;
+
+    return session->connection->get_buffered_amount() > m_outbound_limit;
+}
+
+void Middleware::on_slow_consumer(const con_session_t::ptr &session, const nlohmann::json &message)
+{
+    H_PROFILE_FUNCTION();
+
+    if (session->closing)
         return;
+
+    switch (m_slow_consumer_policy)
+    {
+    case slow_consumer_policy_t::drop:
+    {
+        m_slow_consumer_drops++;
+        H_DEBUG("[SLOW_CONSUMER] [DROP] host => [{}] guid => [{}]", session->host, session->guid);
+        break;
     }
+    case slow_consumer_policy_t::conflate:
+    {
+        std::lock_guard<std::mutex> lock(session->outbound_lock);
+
+        /* Keyed by message type and subject guid, the newest payload wins [batches are conflated event by event] */
+        auto conflate = [&](const nlohmann::json &event) {
+            uint64_t key = (static_cast<uint64_t>(Horus::Protocol::message_type_of(event)) << 32) | event.value("guid", 0u);
+
+            auto it = session->pending.find(key);
+            if (it == session->pending.end())
+            {
+                session->pending_order.push_back(key);
+                session->pending.emplace(key, event);
+            }
+            else
+                it->second = event;
+        };
+
+        if (Horus::Protocol::message_type_of(message) == Horus::Protocol::MessageType::batch)
+        {
+            for (const nlohmann::json &event : message.at("events"))
+                conflate(event);
+        }
+        else
+            conflate(message);
 
-    con_metadata_t::ptr metadata = m_clients_metadata[guid];
+        m_slow_consumer_conflations++;
 
-    if (!metadata)
+        if (!session->drain_timer)
+        {
+            session->conflating = true;
+            session->drain_timer = m_server.set_timer(m_drain_interval, std::bind(&Middleware::drain_slow_consumer, this, session, std::placeholders::_1));
+            H_DEBUG("[SLOW_CONSUMER] [CONFLATE] host => [{}] guid => [{}]", session->host, session->guid);
+        }
+        break;
+    }
+    case slow_consumer_policy_t::disconnect:
     {
-        H_ERROR("[CLIENT] [UPDATE] [NOT_AUTHORIZED] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+        if (session->closing.exchange(true))
+            return;
+
+        m_slow_consumer_disconnects++;
+        H_DEBUG("[SLOW_CONSUMER] [DISCONNECT] host => [{}] guid => [{}]", session->host, session->guid);
+
+        websocketpp::lib::error_code ec;
+        m_server.close(session->handle, websocketpp::close::status::try_again_later, "slow consumer", ec);
+        break;
+    }
+    }
+}
+
+void Middleware::drain_slow_consumer(const con_session_t::ptr &session, const websocketpp::lib::error_code &ec)
+{
+    H_PROFILE_FUNCTION();
+
+    if (ec)
+        return;
+
+    std::lock_guard<std::mutex> lock(session->outbound_lock);
+
+    /* Connection is gone, nothing left to deliver */
+    if (session->connection->get_state() != websocketpp::session::state::open)
+    {
+        session->pending.clear();
+        session->pending_order.clear();
+        session->drain_timer.reset();
+        return;
+    }
+
+    /* Still over the limit, check again later */
+    if (session->connection->get_buffered_amount() > m_outbound_limit)
+    {
+        session->drain_timer = m_server.set_timer(m_drain_interval, std::bind(&Middleware::drain_slow_consumer, this, session, std::placeholders::_1));
         return;
     }
 
-    metadata->state = state;
-    m_clients_metadata[guid] = metadata;
-    H_DEBUG("[CLIENT] [UPDATE] host => [{}] channel => [{}] => [{}]", con->get_host(), res.substr(1), nlohmann::json({{"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
-    m_server.send(metadata->handle, nlohmann::json({{"message_type", "update_agent"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump(), websocketpp::frame::opcode::text);
+    H_DEBUG("[SLOW_CONSUMER] [DRAIN] host => [{}] guid => [{}] pending => [{}]", session->host, session->guid, session->pending_order.size());
 
-    /* Notify all clients */
-    // broadcast_to_clients(nlohmann::json({{"message_type", "update_agent"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
+    /* Everything held back goes out as one batch */
+    if (session->pending_order.size() == 1)
+        send(session, session->pending[session->pending_order.front()]);
+    else
+    {
+        nlohmann::json events = nlohmann::json::array();
+        for (uint64_t key : session->pending_order)
+            events.push_back(std::move(session->pending[key]));
+
+        send(session, Horus::Protocol::make_batch(std::move(events)));
+    }
+
+    session->pending.clear();
+    session->pending_order.clear();
+    session->drain_timer.reset();
+    session->conflating = false;
 }
 
-void Middleware::on_update_by_agent(con_hdl_t handle, nlohmann::json payload)
+slow_consumer_stats_t Middleware::slow_consumer_stats() const
 {
-    server_t::connection_ptr con = m_server.get_con_from_hdl(handle);
-    std::string res = con->get_resource();
+    return slow_consumer_stats_t{m_slow_consumer_drops, m_slow_consumer_conflations, m_slow_consumer_disconnects};
+}
 
-    uint32_t guid = 0;
-    std::string name = "invalid";
-    std::string status = "open";
-    bool state = false;
+handshake_stats_t Middleware::handshake_stats() const
+{
+    return handshake_stats_t{m_handshakes_accepted, m_handshakes_rejected};
+}
+
+heartbeat_stats_t Middleware::heartbeat_stats() const
+{
+    return heartbeat_stats_t{m_heartbeat_timeouts, m_agents_gone};
+}
+
+registry_stats_t Middleware::registry_stats()
+{
+    registry_stats_t stats;
+
+    stats.sessions = m_sessions.size();
+    stats.metadata = m_metadata.size();
+    stats.metadata_bytes = m_metadata.memory_usage();
+    stats.names = m_names.size();
+    stats.names_bytes = m_names.memory_usage();
+    stats.ready_clients = m_ready_clients.size();
+    stats.firehose_clients = m_firehose_clients.size();
+    stats.filtered_clients = m_filtered_clients.size();
+    stats.agent_subscribers = m_agent_subscribers.size();
 
-    try
     {
-        guid = payload.at("guid").get<uint32_t>();
-        name = payload.at("name").get<std::string>();
-        status = payload.at("status").get<std::string>();
-        state = payload.at("state").get<bool>();
+        std::lock_guard<std::mutex> lock(m_pending_lock);
+        stats.pending_updates = m_pending_updates.size();
     }
-    catch (const std::exception &e)
+
     {
-        H_ERROR("[AGENT] [UPDATE] [MISSING_STATE_AGENT_VALUES] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+        std::lock_guard<std::mutex> lock(m_tombstone_lock);
+        stats.tombstones = m_tombstones.size();
+    }
+
+    return stats;
+}
+
+Horus::PoolStats Middleware::buffer_stats() const
+{
+    return server_t::message_type::con_msg_man_type::stats();
+}
+
+std::vector<latency_stats_t> Middleware::latency_stats() const
+{
+    std::vector<latency_stats_t> stats;
+
+    for (std::size_t type = 0; type < Horus::Protocol::message_type_count; ++type)
+    {
+        for (std::size_t stage = 0; stage < latency_stage_count; ++stage)
+        {
+            Horus::Histogram histogram = m_latency.snapshot(type * latency_stage_count + stage);
+
+            if (histogram.count() == 0)
+                continue;
+
+            stats.push_back(latency_stats_t{static_cast<Horus::Protocol::MessageType>(type), static_cast<latency_stage_t>(stage), histogram.count(),
+                                            histogram.percentile(50.0), histogram.percentile(99.0), histogram.percentile(99.9), histogram.max()});
+        }
+    }
+
+    return stats;
+}
+
+std::string Middleware::render_metrics()
+{
+    H_PROFILE_FUNCTION();
+
+    Horus::Metrics::Exposition metrics;
+
+    const channel_t channels[] = {channel_t::agents, channel_t::clients};
+    auto channel_label = [](channel_t channel) { return std::string("channel=\"") + channel_name(channel) + "\""; };
+    auto type_label = [](std::size_t type) { return std::string("type=\"") + Horus::Protocol::to_string(static_cast<Horus::Protocol::MessageType>(type)) + "\""; };
+
+    /* Connections */
+    metrics.family("horus_connections", "Open websocket connections", "gauge");
+    for (channel_t channel : channels)
+        metrics.sample("horus_connections", channel_label(channel), m_connections[static_cast<std::size_t>(channel)].value());
+
+    metrics.family("horus_handshakes_total", "Websocket handshakes by result", "counter");
+    metrics.sample("horus_handshakes_total", "result=\"accepted\"", m_handshakes_accepted.load());
+    metrics.sample("horus_handshakes_total", "result=\"rejected\"", m_handshakes_rejected.load());
+
+    metrics.family("horus_heartbeat_timeouts_total", "Peers closed for missing heartbeats", "counter");
+    metrics.sample("horus_heartbeat_timeouts_total", "", m_heartbeat_timeouts.load());
+
+    /* Traffic */
+    metrics.family("horus_messages_in_total", "Frames received by message type", "counter");
+    for (std::size_t type = 0; type < Horus::Protocol::message_type_count; ++type)
+        metrics.sample("horus_messages_in_total", type_label(type), m_messages_in[type].value());
+
+    metrics.family("horus_messages_out_total", "Frames sent by message type, one per recipient", "counter");
+    for (std::size_t type = 0; type < Horus::Protocol::message_type_count; ++type)
+        metrics.sample("horus_messages_out_total", type_label(type), m_messages_out[type].value());
+
+    metrics.family("horus_bytes_in_total", "Payload bytes received", "counter");
+    for (channel_t channel : channels)
+        metrics.sample("horus_bytes_in_total", channel_label(channel), m_bytes_in[static_cast<std::size_t>(channel)].value());
+
+    metrics.family("horus_bytes_out_total", "Payload bytes sent before compression", "counter");
+    for (channel_t channel : channels)
+        metrics.sample("horus_bytes_out_total", channel_label(channel), m_bytes_out[static_cast<std::size_t>(channel)].value());
+
+    /* Broadcast Fan Out */
+    metrics.family("horus_fan_out_recipients", "Recipients of one broadcast delivery", "histogram");
+    for (std::size_t bucket = 0; bucket < m_fan_out_sizes.bounds().size(); ++bucket)
+        metrics.sample("horus_fan_out_recipients_bucket", "le=\"" + std::to_string(m_fan_out_sizes.bounds()[bucket]) + "\"", m_fan_out_sizes.cumulative(bucket));
+    metrics.sample("horus_fan_out_recipients_bucket", "le=\"+Inf\"", m_fan_out_sizes.count());
+    metrics.sample("horus_fan_out_recipients_sum", "", m_fan_out_sizes.sum());
+    metrics.sample("horus_fan_out_recipients_count", "", m_fan_out_sizes.count());
+
+    /* Send Queues [read at scrape time, the hot path pays nothing for them] */
+    std::array<uint64_t, 3> queued{};
+    uint64_t queued_max = 0;
+    uint64_t conflated = 0;
+
+    for (const con_session_t::ptr &session : m_sessions.values())
+    {
+        uint64_t buffered = session->connection->get_buffered_amount();
+        queued[static_cast<std::size_t>(session->channel)] += buffered;
+        queued_max = std::max(queued_max, buffered);
+
+        if (session->conflating)
+        {
+            std::lock_guard<std::mutex> lock(session->outbound_lock);
+            conflated += session->pending.size();
+        }
+    }
+
+    metrics.family("horus_send_queue_bytes", "Bytes waiting in the outbound buffers", "gauge");
+    for (channel_t channel : channels)
+        metrics.sample("horus_send_queue_bytes", channel_label(channel), queued[static_cast<std::size_t>(channel)]);
+
+    metrics.family("horus_send_queue_max_bytes", "Largest outbound buffer of a single connection", "gauge");
+    metrics.sample("horus_send_queue_max_bytes", "", queued_max);
+
+    metrics.family("horus_send_queue_held_events", "Events held back for slow consumers", "gauge");
+    metrics.sample("horus_send_queue_held_events", "", conflated);
+
+    metrics.family("horus_slow_consumers_total", "Slow consumer policy actions", "counter");
+    metrics.sample("horus_slow_consumers_total", "action=\"drop\"", m_slow_consumer_drops.load());
+    metrics.sample("horus_slow_consumers_total", "action=\"conflate\"", m_slow_consumer_conflations.load());
+    metrics.sample("horus_slow_consumers_total", "action=\"disconnect\"", m_slow_consumer_disconnects.load());
+
+    Horus::PoolStats buffers = buffer_stats();
+    metrics.family("horus_message_buffers_total", "Pooled message buffers by outcome", "counter");
+    metrics.sample("horus_message_buffers_total", "outcome=\"reused\"", buffers.reused);
+    metrics.sample("horus_message_buffers_total", "outcome=\"allocated\"", buffers.allocated);
+    metrics.sample("horus_message_buffers_total", "outcome=\"discarded\"", buffers.discarded);
+
+    /* Latency [summaries from the always on histograms] */
+    metrics.family("horus_latency_seconds", "Latency by message type and stage", "summary");
+
+    for (std::size_t type = 0; type < Horus::Protocol::message_type_count; ++type)
+    {
+        for (std::size_t stage = 0; stage < latency_stage_count; ++stage)
+        {
+            Horus::Histogram histogram = m_latency.snapshot(type * latency_stage_count + stage);
+
+            if (histogram.count() == 0)
+                continue;
+
+            std::string labels = type_label(type) + ",stage=\"" + latency_stage_name(static_cast<latency_stage_t>(stage)) + "\"";
+
+            metrics.sample("horus_latency_seconds", labels + ",quantile=\"0.5\"", histogram.percentile(50.0) / 1e9);
+            metrics.sample("horus_latency_seconds", labels + ",quantile=\"0.99\"", histogram.percentile(99.0) / 1e9);
+            metrics.sample("horus_latency_seconds", labels + ",quantile=\"0.999\"", histogram.percentile(99.9) / 1e9);
+            metrics.sample("horus_latency_seconds_sum", labels, histogram.sum() / 1e9);
+            metrics.sample("horus_latency_seconds_count", labels, histogram.count());
+        }
+    }
+
+    return metrics.text();
+}
+
+void Middleware::record_latency(Horus::Protocol::MessageType message_type, latency_stage_t stage, int64_t elapsed)
+{
+    m_latency.record(static_cast<std::size_t>(message_type) * latency_stage_count + static_cast<std::size_t>(stage), elapsed > 0 ? static_cast<uint64_t>(elapsed) : 0);
+}
+
+void Middleware::on_client_auth(const con_session_t::ptr &session, const Horus::Protocol::AuthMessage &message)
+{
+    /* A second auth would orphan the row of the first */
+    if (session->authenticated)
+    {
+        H_ERROR("[CLIENT] [AUTH] [DUPLICATED] host => [{}] channel => [{}] guid => [{}]", session->host, channel_name(session->channel), session->guid);
         return;
     }
 
-    con_metadata_t::ptr metadata = m_agents_metadata[guid];
+    con_metadata_t metadata{0, Horus::Kind::client, Horus::Status::open, false, m_names.intern("no_name"), 0, session->handle};
 
-    if (!metadata)
+    if (!m_metadata.allocate(metadata))
     {
-        H_ERROR("[AGENT] [UPDATE] [NOT_AUTHORIZED] host => [{}] channel => [{}]", con->get_host(), res.substr(1));
+        H_ERROR("[CLIENT] [AUTH] [REGISTRY_FULL] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        m_names.release(metadata.name);
+
+        websocketpp::lib::error_code ec;
+        m_server.close(session->handle, websocketpp::close::status::try_again_later, "registry full", ec);
         return;
     }
 
-    metadata->status = status;
-    metadata->state = state;
-    metadata->name = name;
-    m_clients_metadata[guid] = metadata;
-    H_DEBUG("[AGENT] [UPDATE] host => [{}] channel => [{}] => [{}]", con->get_host(), res.substr(1), nlohmann::json({{"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
-    // m_server.send(handle, nlohmann::json({{"message_type", "update_agent"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump(), websocketpp::frame::opcode::text);
+    session->guid = metadata.guid;
+    session->authenticated = true;
+
+    nlohmann::json data = metadata_to_json(metadata);
+    H_DEBUG("[CLIENT] [AUTH] host => [{}] channel => [{}] => [{}]", session->host, channel_name(session->channel), data.dump());
+
+    data["message_type"] = "ready";
+    send(session, data);
+}
+
+void Middleware::on_agent_auth(const con_session_t::ptr &session, const Horus::Protocol::AuthMessage &message)
+{
+    /* A second auth would orphan the row of the first */
+    if (session->authenticated)
+    {
+        H_ERROR("[AGENT] [AUTH] [DUPLICATED] host => [{}] channel => [{}] guid => [{}]", session->host, channel_name(session->channel), session->guid);
+        return;
+    }
+
+    con_metadata_t metadata{0, Horus::Kind::agent, Horus::Status::open, false, m_names.intern("no_name"), ++m_registry_version, session->handle};
+
+    if (!m_metadata.allocate(metadata))
+    {
+        H_ERROR("[AGENT] [AUTH] [REGISTRY_FULL] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        m_names.release(metadata.name);
+
+        websocketpp::lib::error_code ec;
+        m_server.close(session->handle, websocketpp::close::status::try_again_later, "registry full", ec);
+        return;
+    }
+
+    session->guid = metadata.guid;
+    session->authenticated = true;
+
+    nlohmann::json data = metadata_to_json(metadata);
+    H_DEBUG("[AGENT] [AUTH] host => [{}] channel => [{}] => [{}]", session->host, channel_name(session->channel), data.dump());
+
+    data["message_type"] = "ready";
+    send(session, data);
+}
+
+void Middleware::on_client_ready(const con_session_t::ptr &session, const Horus::Protocol::ReadyMessage &message)
+{
+    nlohmann::json data;
+
+    /* A client only speaks for the guid it was handed on auth */
+    if (!session->authenticated || message.guid != session->guid)
+    {
+        H_ERROR("[CLIENT] [READY] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    bool authorized = m_metadata.update(session->guid, Horus::Kind::client, [&](con_metadata_t &metadata) {
+        if (metadata.status != Horus::Status::open)
+            return;
+
+        metadata.status = Horus::Status::ready;
+        metadata.state = message.state;
+        rename(metadata, message.name);
+        data = metadata_to_json(metadata);
+    });
+
+    if (!authorized)
+    {
+        H_ERROR("[CLIENT] [READY] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    if (data.is_null())
+        return;
+
+    H_DEBUG("[CLIENT] [READY] host => [{}] channel => [{}] => [{}]", session->host, channel_name(session->channel), data.dump());
+
+    data["message_type"] = "ready";
+    send(session, data);
+
+    /* From now on this client receives broadcasts [every agent until it subscribes] */
+    m_ready_clients.insert(session->guid, session);
+    m_firehose_clients.insert(session->guid, session);
+
+    /* Catch the client up on every agent announced before it was listening */
+    send_snapshot(session, 0);
 
     /* Notify all clients */
-    broadcast_to_clients(nlohmann::json({{"message_type", "update_agent"}, {"status", metadata->status}, {"state", metadata->state}, {"name", metadata->name}, {"guid", guid}}).dump());
+    data["message_type"] = "new_client";
+    broadcast_to_clients(data);
+}
+
+void Middleware::on_agent_ready(const con_session_t::ptr &session, const Horus::Protocol::ReadyMessage &message)
+{
+    nlohmann::json data;
+
+    /* An agent only speaks for the guid it was handed on auth */
+    if (!session->authenticated || message.guid != session->guid)
+    {
+        H_ERROR("[AGENT] [READY] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    bool authorized = m_metadata.update(session->guid, Horus::Kind::agent, [&](con_metadata_t &metadata) {
+        if (metadata.status != Horus::Status::open)
+            return;
+
+        metadata.status = Horus::Status::ready;
+        metadata.state = message.state;
+        rename(metadata, message.name);
+        metadata.version = ++m_registry_version;
+        data = metadata_to_json(metadata);
+    });
+
+    if (!authorized)
+    {
+        H_ERROR("[AGENT] [READY] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    if (data.is_null())
+        return;
+
+    H_DEBUG("[AGENT] [READY] host => [{}] channel => [{}] => [{}]", session->host, channel_name(session->channel), data.dump());
+
+    data["message_type"] = "ready";
+    send(session, data);
+
+    /* The agent now has its real name, match it against the filtered clients */
+    refresh_agent_subscribers(session->guid, message.name);
+
+    /* Notify interested clients */
+    data["message_type"] = "new_agent";
+    publish_agent_event(session->guid, data);
+}
+
+void Middleware::on_update_by_client(const con_session_t::ptr &session, const Horus::Protocol::UpdateMessage &message)
+{
+    nlohmann::json data;
+    bool renamed = false;
+    con_hdl_t agent_handle;
+
+    if (!session->authenticated)
+    {
+        H_ERROR("[CLIENT] [UPDATE] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    /* Clients address agents by their guid */
+    bool authorized = m_metadata.update(message.guid, Horus::Kind::agent, [&](con_metadata_t &metadata) {
+        metadata.status = Horus::status_from_string(message.status);
+        metadata.state = message.state;
+        renamed = rename(metadata, message.name);
+        agent_handle = metadata.handle;
+        metadata.version = ++m_registry_version;
+        data = metadata_to_json(metadata);
+    });
+
+    if (!authorized)
+    {
+        H_ERROR("[CLIENT] [UPDATE] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    H_DEBUG("[CLIENT] [UPDATE] host => [{}] channel => [{}] => [{}]", session->host, channel_name(session->channel), data.dump());
+
+    if (renamed)
+        refresh_agent_subscribers(message.guid, message.name);
+
+    data["message_type"] = "update_agent";
+    send(agent_handle, data);
+
+    /* Notify interested clients, the registry version moved */
+    publish_agent_event(message.guid, data);
+}
+
+void Middleware::on_update_name_by_client(const con_session_t::ptr &session, const Horus::Protocol::UpdateNameMessage &message)
+{
+    nlohmann::json data;
+    bool renamed = false;
+    con_hdl_t agent_handle;
+
+    if (!session->authenticated)
+    {
+        H_ERROR("[CLIENT] [UPDATE] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    bool authorized = m_metadata.update(message.guid, Horus::Kind::agent, [&](con_metadata_t &metadata) {
+        renamed = rename(metadata, message.name);
+        agent_handle = metadata.handle;
+        metadata.version = ++m_registry_version;
+        data = metadata_to_json(metadata);
+    });
+
+    if (!authorized)
+    {
+        H_ERROR("[CLIENT] [UPDATE] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    H_DEBUG("[CLIENT] [UPDATE] host => [{}] channel => [{}] => [{}]", session->host, channel_name(session->channel), data.dump());
+
+    if (renamed)
+        refresh_agent_subscribers(message.guid, message.name);
+
+    data["message_type"] = "update_agent";
+    send(agent_handle, data);
+
+    /* Notify interested clients, the registry version moved */
+    publish_agent_event(message.guid, data);
+}
+
+void Middleware::on_update_state_by_client(const con_session_t::ptr &session, const Horus::Protocol::UpdateStateMessage &message)
+{
+    nlohmann::json data;
+    con_hdl_t agent_handle;
+
+    if (!session->authenticated)
+    {
+        H_ERROR("[CLIENT] [UPDATE] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    bool authorized = m_metadata.update(message.guid, Horus::Kind::agent, [&](con_metadata_t &metadata) {
+        metadata.state = message.state;
+        agent_handle = metadata.handle;
+        metadata.version = ++m_registry_version;
+        data = metadata_to_json(metadata);
+    });
+
+    if (!authorized)
+    {
+        H_ERROR("[CLIENT] [UPDATE] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    H_DEBUG("[CLIENT] [UPDATE] host => [{}] channel => [{}] => [{}]", session->host, channel_name(session->channel), data.dump());
+
+    data["message_type"] = "update_agent";
+    send(agent_handle, data);
+
+    /* Notify interested clients, the registry version moved */
+    publish_agent_event(message.guid, data);
+}
+
+void Middleware::on_update_by_agent(const con_session_t::ptr &session, const Horus::Protocol::UpdateMessage &message)
+{
+    nlohmann::json data;
+    bool renamed = false;
+
+    /* An agent only updates itself */
+    if (!session->authenticated || message.guid != session->guid)
+    {
+        H_ERROR("[AGENT] [UPDATE] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    bool authorized = m_metadata.update(session->guid, Horus::Kind::agent, [&](con_metadata_t &metadata) {
+        metadata.status = Horus::status_from_string(message.status);
+        metadata.state = message.state;
+        renamed = rename(metadata, message.name);
+        metadata.version = ++m_registry_version;
+        data = metadata_to_json(metadata);
+    });
+
+    if (!authorized)
+    {
+        H_ERROR("[AGENT] [UPDATE] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    H_DEBUG("[AGENT] [UPDATE] host => [{}] channel => [{}] => [{}]", session->host, channel_name(session->channel), data.dump());
+
+    if (renamed)
+        refresh_agent_subscribers(message.guid, message.name);
+
+    data["message_type"] = "update_agent";
+
+    /* Traced updates keep their id on the way to the clients */
+    if (message.trace)
+    {
+        H_PROFILE_FLOW_STEP("update_agent", message.trace);
+        data["trace"] = message.trace;
+    }
+
+    if (m_conflation_window.count() == 0)
+    {
+        /* Notify interested clients */
+        publish_agent_event(message.guid, data);
+        return;
+    }
+
+    /* Keep only the newest update of this agent until the window closes */
+    std::lock_guard<std::mutex> lock(m_pending_lock);
+
+    auto pending = m_pending_updates.find(message.guid);
+
+    /* The oldest arrival is kept, end to end then measures how stale the update got */
+    if (pending == m_pending_updates.end())
+    {
+        m_pending_updates.emplace(message.guid, pending_update_t{std::move(data), m_received});
+    }
+    else
+    {
+        pending->second.message = std::move(data);
+        m_conflated_updates++;
+    }
+
+    if (!m_flush_timer)
+        m_flush_timer = m_server.set_timer(m_conflation_window.count(), std::bind(&Middleware::flush_agent_updates, this, std::placeholders::_1));
+}
+
+void Middleware::flush_agent_updates(const websocketpp::lib::error_code &ec)
+{
+    H_PROFILE_FUNCTION();
+
+    if (ec)
+        return;
+
+    std::unordered_map<uint32_t, pending_update_t> updates;
+    uint64_t conflated = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_pending_lock);
+        updates.swap(m_pending_updates);
+        std::swap(conflated, m_conflated_updates);
+        m_flush_timer.reset();
+    }
+
+    H_DEBUG("[CONFLATION] [FLUSH] updates => [{}] conflated => [{}]", updates.size(), conflated);
+
+    /* Notify interested clients */
+    for (auto &update : updates)
+        queue_broadcast(broadcast_event_t{true, update.first, std::move(update.second.message), false, update.second.received});
 }
 
-void Middleware::handle_client_message(std::string message_type, con_hdl_t handle, nlohmann::json payload)
+nlohmann::json Middleware::metadata_to_json(const con_metadata_t &metadata)
 {
-    if (message_type == "auth")
-        on_client_auth(handle, payload);
-    else if (message_type == "ready")
-        on_client_ready(handle, payload);
-    else if (message_type == "update_agent")
-        on_update_by_client(handle, payload);
-    else if (message_type == "update_agent_name")
-        on_update_name_by_client(handle, payload);
-    else if (message_type == "update_agent_state")
-        on_update_state_by_client(handle, payload);
+    return nlohmann::json({{"status", Horus::to_string(metadata.status)}, {"state", metadata.state}, {"name", m_names.name(metadata.name)}, {"guid", metadata.guid}, {"version", metadata.version}});
 }
 
-void Middleware::handle_agent_message(std::string message_type, con_hdl_t handle, nlohmann::json payload)
+bool Middleware::rename(con_metadata_t &metadata, const std::string &name)
 {
-    if (message_type == "auth")
-        on_agent_auth(handle, payload);
-    else if (message_type == "ready")
-        on_agent_ready(handle, payload);
-    else if (message_type == "update_agent")
-        on_update_by_agent(handle, payload);
+    /* Most updates repeat the name, those never touch the table lock exclusively */
+    if (m_names.name(metadata.name) == name)
+        return false;
+
+    uint32_t previous = metadata.name;
+    metadata.name = m_names.intern(name);
+    m_names.release(previous);
+    return true;
+}
+
+bool Middleware::erase_metadata(uint32_t guid, con_metadata_t &removed)
+{
+    if (!m_metadata.erase(guid, removed))
+        return false;
+
+    m_names.release(removed.name);
+    return true;
+}
+
+void Middleware::on_client_subscribe(const con_session_t::ptr &session, const Horus::Protocol::SubscribeMessage &message)
+{
+    if (!session->authenticated || !m_ready_clients.contains(session->guid))
+    {
+        H_ERROR("[CLIENT] [SUBSCRIBE] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    std::shared_ptr<con_subscription_t> subscription;
+
+    if (!message.everything())
+    {
+        subscription = std::make_shared<con_subscription_t>();
+        subscription->guids.insert(message.guids.begin(), message.guids.end());
+        subscription->ranges = message.ranges;
+        subscription->prefixes = message.prefixes;
+    }
+
+    set_subscription(session, subscription);
+
+    H_DEBUG("[CLIENT] [SUBSCRIBE] host => [{}] channel => [{}] guids => [{}] ranges => [{}] prefixes => [{}]", session->host, channel_name(session->channel), message.guids.size(), message.ranges.size(), message.prefixes.size());
+
+    /* Replace what the client knew with its new slice */
+    send_snapshot(session, 0);
+}
+
+void Middleware::set_subscription(const con_session_t::ptr &session, std::shared_ptr<const con_subscription_t> subscription)
+{
+    H_PROFILE_FUNCTION();
+
+    {
+        std::lock_guard<std::mutex> lock(session->subscription_lock);
+
+        for (uint32_t agent : session->subscribed_agents)
+            remove_subscriber(agent, session);
+
+        session->subscribed_agents.clear();
+        session->subscription = subscription;
+
+        if (subscription)
+        {
+            m_metadata.for_each(Horus::Kind::agent, [&](const con_metadata_t &metadata) {
+                if (subscription->matches(metadata.guid, m_names.name(metadata.name)))
+                    session->subscribed_agents.insert(metadata.guid);
+            });
+
+            for (uint32_t agent : session->subscribed_agents)
+                add_subscriber(agent, session);
+        }
+    }
+
+    /* Index moves happen outside the subscription lock, fan-out takes them in the opposite order */
+    if (subscription)
+    {
+        m_firehose_clients.erase(session->guid);
+        m_filtered_clients.insert(session->guid, session);
+    }
+    else
+    {
+        m_filtered_clients.erase(session->guid);
+        m_firehose_clients.insert(session->guid, session);
+    }
+}
+
+void Middleware::refresh_agent_subscribers(uint32_t guid, const std::string &name)
+{
+    H_PROFILE_FUNCTION();
+
+    std::vector<con_session_t::ptr> clients;
+    m_filtered_clients.for_each([&](uint32_t, const con_session_t::ptr &client) { clients.push_back(client); });
+
+    for (const con_session_t::ptr &client : clients)
+    {
+        std::lock_guard<std::mutex> lock(client->subscription_lock);
+
+        if (!client->subscription)
+            continue;
+
+        bool matches = client->subscription->matches(guid, name);
+        bool subscribed = client->subscribed_agents.count(guid) > 0;
+
+        if (matches && !subscribed)
+        {
+            client->subscribed_agents.insert(guid);
+            add_subscriber(guid, client);
+        }
+        else if (!matches && subscribed)
+        {
+            client->subscribed_agents.erase(guid);
+            remove_subscriber(guid, client);
+        }
+    }
+}
+
+void Middleware::add_subscriber(uint32_t guid, const con_session_t::ptr &session)
+{
+    m_agent_subscribers.upsert(guid, [&](std::vector<con_session_t::ptr> &subscribers) { subscribers.push_back(session); });
+}
+
+void Middleware::remove_subscriber(uint32_t guid, const con_session_t::ptr &session)
+{
+    m_agent_subscribers.update(guid, [&](std::vector<con_session_t::ptr> &subscribers) {
+        subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), session), subscribers.end());
+    });
+
+    m_agent_subscribers.erase_if(guid, [](const std::vector<con_session_t::ptr> &subscribers) { return subscribers.empty(); });
+}
+
+void Middleware::on_client_sync(const con_session_t::ptr &session, const Horus::Protocol::SyncMessage &message)
+{
+    if (!session->authenticated || !m_ready_clients.contains(session->guid))
+    {
+        H_ERROR("[CLIENT] [SYNC] [NOT_AUTHORIZED] host => [{}] channel => [{}]", session->host, channel_name(session->channel));
+        return;
+    }
+
+    send_snapshot(session, message.since);
+}
+
+void Middleware::send_snapshot(const con_session_t::ptr &session, uint64_t since)
+{
+    H_PROFILE_FUNCTION();
+
+    std::shared_ptr<const con_subscription_t> subscription;
+
+    {
+        std::lock_guard<std::mutex> lock(session->subscription_lock);
+        subscription = session->subscription;
+    }
+
+    /* Read the version first, rows changed meanwhile also reach the client as versioned deltas */
+    uint64_t version = m_registry_version;
+    nlohmann::json agents = Horus::Protocol::make_snapshot_columns();
+    nlohmann::json gone = nlohmann::json::array();
+
+    {
+        std::lock_guard<std::mutex> lock(m_tombstone_lock);
+
+        /* Agents gone before the oldest tombstone kept are unknown, only a full snapshot is complete */
+        if (since < m_tombstone_floor)
+            since = 0;
+
+        if (since > 0)
+            for (const std::pair<uint64_t, uint32_t> &tombstone : m_tombstones)
+                if (tombstone.first > since)
+                    gone.push_back(tombstone.second);
+    }
+
+    m_metadata.for_each(Horus::Kind::agent, [&](const con_metadata_t &metadata) {
+        /* Agents that never went ready were never announced */
+        if (metadata.status == Horus::Status::open || metadata.version <= since)
+            return;
+
+        if (subscription && !subscription->matches(metadata.guid, m_names.name(metadata.name)))
+            return;
+
+        agents["guid"].push_back(metadata.guid);
+        agents["name"].push_back(m_names.name(metadata.name));
+        agents["status"].push_back(Horus::to_string(metadata.status));
+        agents["state"].push_back(metadata.state);
+        agents["version"].push_back(metadata.version);
+    });
+
+    H_DEBUG("[CLIENT] [SNAPSHOT] host => [{}] channel => [{}] since => [{}] version => [{}] agents => [{}] gone => [{}]", session->host, channel_name(session->channel), since, version, agents["guid"].size(), gone.size());
+
+    send(session, nlohmann::json({{"message_type", "snapshot"}, {"version", version}, {"since", since}, {"agents", std::move(agents)}, {"gone", std::move(gone)}}));
+}
+
+template <typename Message>
+void Middleware::dispatch(const con_session_t::ptr &session, const nlohmann::json &payload, void (Middleware::*handler)(const con_session_t::ptr &, const Message &))
+{
+    Message message;
+
+    if (!Horus::Protocol::decode(payload, message))
+    {
+        H_ERROR("[MESSAGE] [MALFORMED] host => [{}] channel => [{}] message_type => [{}]", session->host, channel_name(session->channel), payload.at("message_type").get_ref<const std::string &>());
+        return;
+    }
+
+    (this->*handler)(session, message);
+}
+
+void Middleware::handle_client_message(Horus::Protocol::MessageType message_type, const con_session_t::ptr &session, const nlohmann::json &payload)
+{
+    using Horus::Protocol::MessageType;
+
+    switch (message_type)
+    {
+    case MessageType::auth:
+        return dispatch(session, payload, &Middleware::on_client_auth);
+    case MessageType::ready:
+        return dispatch(session, payload, &Middleware::on_client_ready);
+    case MessageType::update_agent:
+        return dispatch(session, payload, &Middleware::on_update_by_client);
+    case MessageType::update_agent_name:
+        return dispatch(session, payload, &Middleware::on_update_name_by_client);
+    case MessageType::update_agent_state:
+        return dispatch(session, payload, &Middleware::on_update_state_by_client);
+    case MessageType::sync:
+        return dispatch(session, payload, &Middleware::on_client_sync);
+    case MessageType::subscribe:
+        return dispatch(session, payload, &Middleware::on_client_subscribe);
+    default:
+        break;
+    }
+}
+
+void Middleware::handle_agent_message(Horus::Protocol::MessageType message_type, const con_session_t::ptr &session, const nlohmann::json &payload)
+{
+    using Horus::Protocol::MessageType;
+
+    switch (message_type)
+    {
+    case MessageType::auth:
+        return dispatch(session, payload, &Middleware::on_agent_auth);
+    case MessageType::ready:
+        return dispatch(session, payload, &Middleware::on_agent_ready);
+    case MessageType::update_agent:
+        return dispatch(session, payload, &Middleware::on_update_by_agent);
+    default:
+        break;
+    }
 }
@@ -8,11 +8,15 @@
 
 /* StdLib Stuff */
 #include <set>
+#include <deque>
 #include <regex>
 #include <mutex>
 #include <atomic>
 #include <string>
 #include <thread>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
 #include <chrono>
 #include <fstream>
 #include <iostream>
@@ -0,0 +1,144 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_message.hpp>
+
+#include <zlib.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+#include "core/deflate.h"
+
+/* Compresses messages the way permessage-deflate does [raw deflate, sync flush, trailer stripped] */
+class MessageDeflater
+{
+private:
+    z_stream m_stream{};
+    bool m_no_context_takeover;
+
+public:
+    MessageDeflater(uint8_t window_bits, bool no_context_takeover) : m_no_context_takeover(no_context_takeover)
+    {
+        deflateInit2(&m_stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -static_cast<int>(window_bits), 8, Z_DEFAULT_STRATEGY);
+    }
+
+    ~MessageDeflater() { deflateEnd(&m_stream); }
+
+    std::size_t compress(const std::string &message)
+    {
+        unsigned char buffer[16384];
+        std::size_t size = 0;
+
+        m_stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(message.data()));
+        m_stream.avail_in = static_cast<uInt>(message.size());
+
+        do
+        {
+            m_stream.next_out = buffer;
+            m_stream.avail_out = sizeof(buffer);
+            deflate(&m_stream, Z_SYNC_FLUSH);
+            size += sizeof(buffer) - m_stream.avail_out;
+        } while (m_stream.avail_out == 0);
+
+        if (m_no_context_takeover)
+            deflateReset(&m_stream);
+
+        /* The 0x00 0x00 0xff 0xff flush trailer is not sent */
+        return size - 4;
+    }
+};
+
+TEST_CASE("Deflate window bits are clamped", "[deflate]")
+{
+    REQUIRE(Horus::Deflate::clamp_window_bits(0) == 8);
+    REQUIRE(Horus::Deflate::clamp_window_bits(10) == 10);
+    REQUIRE(Horus::Deflate::clamp_window_bits(64) == 15);
+}
+
+TEST_CASE("Deflate extension applies the settings", "[deflate]")
+{
+    typedef Horus::Deflate::Config::permessage_deflate_type extension_t;
+
+    const Horus::Deflate::Settings defaults = Horus::Deflate::settings();
+
+    /* Defaults offer the upstream window and keep the context */
+    {
+        extension_t extension;
+        REQUIRE(extension.generate_offer() == "permessage-deflate; client_max_window_bits");
+
+        websocketpp::http::attribute_list offer;
+        offer["client_max_window_bits"] = "";
+
+        std::pair<websocketpp::lib::error_code, std::string> response = extension.negotiate(offer);
+        REQUIRE_FALSE(response.first);
+        REQUIRE(response.second.find("server_max_window_bits") == std::string::npos);
+        REQUIRE(response.second.find("no_context_takeover") == std::string::npos);
+    }
+
+    /* Settings are read by every extension constructed after they change */
+    Horus::Deflate::settings().max_window_bits = 10;
+    Horus::Deflate::settings().no_context_takeover = true;
+
+    {
+        extension_t extension;
+        REQUIRE(extension.generate_offer() == "permessage-deflate; client_max_window_bits=10; server_max_window_bits=10; client_no_context_takeover; server_no_context_takeover");
+
+        /* A server answering a bare offer still caps its own window and drops its context */
+        websocketpp::http::attribute_list offer;
+        offer["client_max_window_bits"] = "";
+
+        std::pair<websocketpp::lib::error_code, std::string> response = extension.negotiate(offer);
+        REQUIRE_FALSE(response.first);
+        REQUIRE(extension.is_enabled());
+        REQUIRE(response.second.find("server_max_window_bits=10") != std::string::npos);
+        REQUIRE(response.second.find("server_no_context_takeover") != std::string::npos);
+    }
+
+    Horus::Deflate::settings() = defaults;
+}
+
+TEST_CASE("Deflate bytes on the wire vs CPU", "[deflate][benchmark]")
+{
+    const uint32_t messages = 20000;
+
+    std::vector<std::string> payloads;
+    payloads.reserve(messages);
+
+    std::size_t raw = 0;
+    for (uint32_t i = 0; i < messages; ++i)
+    {
+        payloads.push_back(nlohmann::json({{"message_type", "update_agent"}, {"status", "ready"}, {"state", i % 2 == 0}, {"name", "agent-" + std::to_string(i % 500)}, {"guid", i % 500}}).dump());
+        raw += payloads.back().size();
+    }
+
+    struct Setup
+    {
+        uint8_t window_bits;
+        bool no_context_takeover;
+    };
+
+    std::size_t best = raw;
+
+    for (Setup setup : {Setup{15, false}, Setup{9, false}, Setup{15, true}, Setup{9, true}})
+    {
+        MessageDeflater deflater(setup.window_bits, setup.no_context_takeover);
+
+        std::size_t wire = 0;
+        auto start = std::chrono::steady_clock::now();
+
+        for (const std::string &payload : payloads)
+            wire += deflater.compress(payload);
+
+        double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        best = std::min(best, wire);
+
+        WARN("window_bits " << int(setup.window_bits) << (setup.no_context_takeover ? " no_context_takeover" : " context_takeover")
+                            << ": " << wire << " of " << raw << " bytes (" << (100.0 * wire / raw) << "%), "
+                            << (elapsed / messages) << " us/message");
+    }
+
+    /* Repetitive keys compress well once the window keeps earlier messages */
+    REQUIRE(best * 3 < raw);
+}
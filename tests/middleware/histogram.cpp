@@ -0,0 +1,126 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_message.hpp>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+#include "core/histogram.h"
+
+TEST_CASE("Histogram buckets stay within their precision", "[histogram]")
+{
+    /* Small values are exact */
+    for (uint64_t value = 0; value < Horus::Histogram::sub_bucket_count; ++value)
+        REQUIRE(Horus::Histogram::value_at(Horus::Histogram::index_of(value)) == value);
+
+    uint64_t previous = 0;
+
+    for (uint64_t value = 1; value < (uint64_t(1) << Horus::Histogram::max_magnitude); value = value * 3 / 2 + 1)
+    {
+        std::size_t index = Horus::Histogram::index_of(value);
+        uint64_t highest = Horus::Histogram::value_at(index);
+
+        REQUIRE(index < Horus::Histogram::bucket_count);
+        REQUIRE(index >= previous);
+        REQUIRE(highest >= value);
+        REQUIRE(highest - value <= value / Horus::Histogram::sub_bucket_count);
+
+        previous = index;
+    }
+
+    /* Out of range values share the last bucket */
+    REQUIRE(Horus::Histogram::index_of(UINT64_MAX) == Horus::Histogram::bucket_count - 1);
+}
+
+TEST_CASE("Histogram percentiles", "[histogram]")
+{
+    Horus::Histogram histogram;
+
+    REQUIRE(histogram.percentile(99.0) == 0);
+
+    for (uint64_t value = 1; value <= 100000; ++value)
+        histogram.record(value * 1000);
+
+    REQUIRE(histogram.count() == 100000);
+    REQUIRE(histogram.max() == 100000000);
+    REQUIRE(histogram.mean() == 50000500);
+
+    auto near = [](uint64_t reported, uint64_t expected) {
+        return reported >= expected && reported - expected <= expected / Horus::Histogram::sub_bucket_count;
+    };
+
+    REQUIRE(near(histogram.percentile(50.0), 50000000));
+    REQUIRE(near(histogram.percentile(99.0), 99000000));
+    REQUIRE(near(histogram.percentile(99.9), 99900000));
+    REQUIRE(histogram.percentile(100.0) == histogram.max());
+
+    Horus::Histogram other;
+    other.record(500000000);
+    histogram.merge(other);
+
+    REQUIRE(histogram.count() == 100001);
+    REQUIRE(histogram.max() == 500000000);
+    REQUIRE(histogram.percentile(100.0) == 500000000);
+}
+
+TEST_CASE("Histogram set merges every recording thread", "[histogram]")
+{
+    const std::size_t threads = 8;
+    const uint64_t samples = 100000;
+
+    Horus::HistogramSet<4> set;
+    std::vector<std::thread> workers;
+
+    for (std::size_t thread = 0; thread < threads; ++thread)
+    {
+        workers.emplace_back([&set, thread]() {
+            for (uint64_t sample = 0; sample < samples; ++sample)
+                set.record(thread % 2, sample + thread);
+        });
+    }
+
+    for (std::thread &worker : workers)
+        worker.join();
+
+    REQUIRE(set.threads() == threads);
+
+    Horus::Histogram even = set.snapshot(0);
+    Horus::Histogram odd = set.snapshot(1);
+
+    REQUIRE(even.count() == threads / 2 * samples);
+    REQUIRE(odd.count() == threads / 2 * samples);
+    REQUIRE(odd.max() == samples - 1 + threads - 1);
+    REQUIRE(set.snapshot(2).count() == 0);
+
+    /* A second set on the same thread gets its own buckets */
+    Horus::HistogramSet<4> other;
+    other.record(3, 42);
+    set.record(3, 7);
+
+    REQUIRE(other.snapshot(3).max() == 42);
+    REQUIRE(set.snapshot(3).max() == 7);
+}
+
+TEST_CASE("Histogram set recording cost", "[histogram][benchmark]")
+{
+    const std::size_t samples = 10000000;
+
+    Horus::HistogramSet<56> set;
+
+    auto start = std::chrono::steady_clock::now();
+
+    for (std::size_t sample = 0; sample < samples; ++sample)
+        set.record(sample % 56, sample);
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double record_ns = std::chrono::duration<double, std::nano>(elapsed).count() / samples;
+
+    WARN("ns per recorded sample " << record_ns);
+
+    uint64_t total = 0;
+    for (std::size_t series = 0; series < 56; ++series)
+        total += set.snapshot(series).count();
+
+    REQUIRE(total == samples);
+}
@@ -0,0 +1,241 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_message.hpp>
+
+#include <map>
+#include <set>
+#include <memory>
+#include <vector>
+#include <string>
+
+#include "core/metadata.h"
+
+/* Allocator that adds every allocation to a shared byte counter */
+template <typename T>
+struct CountingAllocator
+{
+    typedef T value_type;
+
+    std::size_t *bytes;
+
+    explicit CountingAllocator(std::size_t *bytes) : bytes(bytes) {}
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U> &other) : bytes(other.bytes) {}
+
+    T *allocate(std::size_t n)
+    {
+        *bytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T *p, std::size_t n) { std::allocator<T>().deallocate(p, n); }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U> &other) const { return bytes == other.bytes; }
+
+    template <typename U>
+    bool operator!=(const CountingAllocator<U> &other) const { return bytes != other.bytes; }
+};
+
+/* Layout used before the compact table [shared_ptr per guid inside a std::map] */
+struct LegacyMetadata
+{
+    std::string status;
+    bool state;
+    std::string name;
+    std::weak_ptr<void> handle;
+    uint32_t guid;
+};
+
+TEST_CASE("Metadata table round trips records", "[metadata]")
+{
+    Horus::NameTable names;
+    Horus::MetadataTable<std::weak_ptr<void>> table;
+
+    uint32_t name = names.intern("agent");
+    REQUIRE(names.intern("agent") == name);
+    REQUIRE(names.name(name) == "agent");
+
+    Horus::MetadataTable<std::weak_ptr<void>>::Record agent{0, Horus::Kind::agent, Horus::Status::open, false, name, 1, {}};
+    REQUIRE(table.allocate(agent));
+    REQUIRE(table.size() == 1);
+
+    uint32_t guid = agent.guid;
+
+    REQUIRE(table.update(guid, Horus::Kind::agent, [](Horus::MetadataTable<std::weak_ptr<void>>::Record &record) {
+        record.status = Horus::Status::ready;
+        record.state = true;
+        record.version = 2;
+    }));
+    REQUIRE_FALSE(table.update(guid, Horus::Kind::client, [](Horus::MetadataTable<std::weak_ptr<void>>::Record &) {}));
+    REQUIRE_FALSE(table.update(guid + 1, [](Horus::MetadataTable<std::weak_ptr<void>>::Record &) {}));
+
+    Horus::MetadataTable<std::weak_ptr<void>>::Record record;
+    REQUIRE(table.find(guid, record));
+    REQUIRE(record.guid == guid);
+    REQUIRE(record.kind == Horus::Kind::agent);
+    REQUIRE(record.status == Horus::Status::ready);
+    REQUIRE(record.state);
+    REQUIRE(record.version == 2);
+    REQUIRE(names.name(record.name) == "agent");
+
+    REQUIRE(table.erase(guid));
+    REQUIRE_FALSE(table.find(guid, record));
+    REQUIRE(table.size() == 0);
+}
+
+TEST_CASE("Name table frees names once the last reference drops", "[metadata]")
+{
+    Horus::NameTable names;
+
+    uint32_t shared = names.intern("shared");
+    REQUIRE(names.intern("shared") == shared);
+
+    /* Unique names churning through the table reuse the same ids */
+    for (uint32_t i = 0; i < 100000; ++i)
+    {
+        uint32_t id = names.intern("unique-" + std::to_string(i));
+        REQUIRE(names.name(id) == "unique-" + std::to_string(i));
+        names.release(id);
+    }
+
+    REQUIRE(names.size() == 1);
+
+    names.release(shared);
+    REQUIRE(names.name(shared) == "shared");
+    names.release(shared);
+    REQUIRE(names.size() == 0);
+
+    /* A freed id goes to the next new name, extra releases are ignored */
+    names.release(shared);
+    uint32_t other = names.intern("other");
+    REQUIRE(names.name(other) == "other");
+    REQUIRE(names.size() == 1);
+    REQUIRE(names.memory_usage() < 4096);
+}
+
+TEST_CASE("Metadata table reuses slots under a new generation", "[metadata]")
+{
+    typedef Horus::MetadataTable<std::weak_ptr<void>, 1> table_t;
+    table_t table;
+
+    table_t::Record first{0, Horus::Kind::client, Horus::Status::open, false, 0, 0, {}};
+    REQUIRE(table.allocate(first));
+    REQUIRE(first.guid != 0);
+
+    /* Freed rows are only reused once more than reuse_depth are queued */
+    std::vector<uint32_t> queued;
+    for (std::size_t i = 0; i < table_t::reuse_depth; ++i)
+    {
+        table_t::Record row{0, Horus::Kind::client, Horus::Status::open, false, 0, 0, {}};
+        REQUIRE(table.allocate(row));
+        REQUIRE(table_t::index_of(row.guid) != table_t::index_of(first.guid));
+        queued.push_back(row.guid);
+    }
+
+    REQUIRE(table.erase(first.guid));
+    for (uint32_t guid : queued)
+        REQUIRE(table.erase(guid));
+
+    /* Oldest freed slot, next generation */
+    table_t::Record second{0, Horus::Kind::agent, Horus::Status::open, false, 0, 0, {}};
+    REQUIRE(table.allocate(second));
+    REQUIRE(table_t::index_of(second.guid) == table_t::index_of(first.guid));
+    REQUIRE(table_t::generation_of(second.guid) == table_t::generation_of(first.guid) + 1);
+
+    /* The stale guid no longer resolves */
+    table_t::Record record;
+    REQUIRE_FALSE(table.contains(first.guid));
+    REQUIRE_FALSE(table.find(first.guid, record));
+    REQUIRE_FALSE(table.erase(first.guid));
+    REQUIRE(table.contains(second.guid));
+
+    /* Iteration by kind skips the other side */
+    table_t::Record client{0, Horus::Kind::client, Horus::Status::open, false, 0, 0, {}};
+    REQUIRE(table.allocate(client));
+
+    std::size_t agents = 0;
+    table.for_each(Horus::Kind::agent, [&](const table_t::Record &row) {
+        REQUIRE(row.guid == second.guid);
+        agents++;
+    });
+    REQUIRE(agents == 1);
+    REQUIRE(table.size() == 2);
+}
+
+TEST_CASE("Metadata table never resolves a stale guid across a generation cycle", "[metadata]")
+{
+    typedef Horus::MetadataTable<std::weak_ptr<void>, 1> table_t;
+    table_t table;
+
+    table_t::Record stale{0, Horus::Kind::agent, Horus::Status::open, false, 0, 0, {}};
+    REQUIRE(table.allocate(stale));
+    REQUIRE(table.erase(stale.guid));
+
+    /* Churn long enough for every queued slot to run through all its generations */
+    std::set<uint32_t> seen{stale.guid};
+    bool unique = true, resolved = false, zero = false;
+
+    for (std::size_t i = 0; i < (table_t::generation_mask + 1) * (table_t::reuse_depth + 2); ++i)
+    {
+        table_t::Record record{0, Horus::Kind::agent, Horus::Status::open, false, 0, 0, {}};
+        REQUIRE(table.allocate(record));
+
+        zero |= record.guid == 0;
+        unique &= seen.insert(record.guid).second;
+        resolved |= table.contains(stale.guid);
+
+        REQUIRE(table.erase(record.guid));
+    }
+
+    REQUIRE_FALSE(zero);
+    REQUIRE(unique);
+    REQUIRE_FALSE(resolved);
+    REQUIRE_FALSE(table.contains(stale.guid));
+    REQUIRE(table.size() == 0);
+}
+
+TEST_CASE("Metadata memory per agent at 1M agents", "[metadata][memory]")
+{
+    const uint32_t agents = 1000000;
+    const uint32_t distinct_names = 1000;
+
+    /* Compact layout */
+    Horus::NameTable names;
+    Horus::MetadataTable<std::weak_ptr<void>> table;
+
+    for (uint32_t guid = 0; guid < agents; ++guid)
+    {
+        Horus::MetadataTable<std::weak_ptr<void>>::Record record{0, Horus::Kind::agent, Horus::Status::ready, guid % 2 == 0, names.intern("agent-" + std::to_string(guid % distinct_names)), guid, {}};
+        table.allocate(record);
+    }
+
+    REQUIRE(table.size() == agents);
+
+    double compact = double(table.memory_usage() + names.memory_usage()) / agents;
+
+    /* Legacy layout */
+    std::size_t legacy_bytes = 0;
+    {
+        typedef std::pair<const uint32_t, std::shared_ptr<LegacyMetadata>> entry_t;
+        CountingAllocator<entry_t> allocator(&legacy_bytes);
+        std::map<uint32_t, std::shared_ptr<LegacyMetadata>, std::less<uint32_t>, CountingAllocator<entry_t>> map(allocator);
+
+        for (uint32_t guid = 0; guid < agents; ++guid)
+        {
+            auto metadata = std::allocate_shared<LegacyMetadata>(CountingAllocator<LegacyMetadata>(&legacy_bytes));
+            metadata->status = "ready";
+            metadata->state = guid % 2 == 0;
+            metadata->name = "agent-" + std::to_string(guid % distinct_names);
+            metadata->guid = guid;
+            map.emplace(guid, metadata);
+        }
+    }
+
+    double legacy = double(legacy_bytes) / agents;
+
+    WARN("metadata bytes per agent at " << agents << " agents: compact " << compact << ", legacy " << legacy);
+
+    REQUIRE(compact < legacy);
+    REQUIRE(compact < 48.0);
+}
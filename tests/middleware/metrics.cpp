@@ -0,0 +1,74 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <array>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "core/metrics.h"
+
+TEST_CASE("Sharded counters add up across threads", "[metrics]")
+{
+    const std::size_t threads = 32;
+    const uint64_t increments = 100000;
+
+    Horus::Metrics::Counter counter;
+    Horus::Metrics::Gauge gauge;
+    std::vector<std::thread> workers;
+
+    for (std::size_t thread = 0; thread < threads; ++thread)
+    {
+        workers.emplace_back([&]() {
+            for (uint64_t increment = 0; increment < increments; ++increment)
+            {
+                counter.add();
+                gauge.add(2);
+                gauge.sub();
+            }
+        });
+    }
+
+    for (std::thread &worker : workers)
+        worker.join();
+
+    REQUIRE(counter.value() == threads * increments);
+    REQUIRE(gauge.value() == static_cast<int64_t>(threads * increments));
+
+    gauge.sub(static_cast<int64_t>(threads * increments) + 1);
+    REQUIRE(gauge.value() == -1);
+}
+
+TEST_CASE("Bucket counters are cumulative", "[metrics]")
+{
+    Horus::Metrics::BucketCounter<3> buckets({1, 10, 100});
+
+    for (uint64_t value : {0, 1, 2, 10, 50, 100, 1000, 5000})
+        buckets.observe(value);
+
+    REQUIRE(buckets.cumulative(0) == 2);
+    REQUIRE(buckets.cumulative(1) == 4);
+    REQUIRE(buckets.cumulative(2) == 6);
+    REQUIRE(buckets.cumulative(3) == 8);
+    REQUIRE(buckets.count() == 8);
+    REQUIRE(buckets.sum() == 6163);
+}
+
+TEST_CASE("Exposition writes the Prometheus text format", "[metrics]")
+{
+    Horus::Metrics::Exposition metrics;
+
+    metrics.family("horus_connections", "Open websocket connections", "gauge");
+    metrics.sample("horus_connections", "channel=\"agents\"", int64_t(3));
+    metrics.family("horus_latency_seconds", "Latency", "summary");
+    metrics.sample("horus_latency_seconds", "quantile=\"0.99\"", 0.000125);
+    metrics.sample("horus_latency_seconds_count", "", uint64_t(42));
+
+    REQUIRE(metrics.text() == "# HELP horus_connections Open websocket connections\n"
+                              "# TYPE horus_connections gauge\n"
+                              "horus_connections{channel=\"agents\"} 3\n"
+                              "# HELP horus_latency_seconds Latency\n"
+                              "# TYPE horus_latency_seconds summary\n"
+                              "horus_latency_seconds{quantile=\"0.99\"} 0.000125\n"
+                              "horus_latency_seconds_count 42\n");
+}
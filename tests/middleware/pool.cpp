@@ -0,0 +1,70 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "core/pool.h"
+
+TEST_CASE("Object pool recycles up to its byte budget", "[pool]")
+{
+    Horus::ObjectPool<std::string> pool(2048, 2048);
+
+    REQUIRE(pool.take() == nullptr);
+
+    std::unique_ptr<std::string> buffer(new std::string());
+    pool.allocated();
+    buffer->reserve(1024);
+
+    const char *storage = buffer->data();
+    REQUIRE(pool.give(std::move(buffer), 1024));
+    REQUIRE(pool.size() == 1);
+    REQUIRE(pool.bytes() == 1024);
+
+    /* The same object comes back with its capacity */
+    std::unique_ptr<std::string> reused = pool.take();
+    REQUIRE(reused);
+    REQUIRE(reused->data() == storage);
+    REQUIRE(reused->capacity() >= 1024);
+    REQUIRE(pool.bytes() == 0);
+
+    REQUIRE(pool.give(std::move(reused), 1024));
+    REQUIRE(pool.give(std::unique_ptr<std::string>(new std::string()), 1024));
+    REQUIRE_FALSE(pool.give(std::unique_ptr<std::string>(new std::string()), 1));
+    REQUIRE(pool.size() == 2);
+    REQUIRE(pool.bytes() == 2048);
+
+    Horus::PoolStats stats = pool.stats();
+    REQUIRE(stats.reused == 1);
+    REQUIRE(stats.allocated == 1);
+    REQUIRE(stats.discarded == 1);
+}
+
+TEST_CASE("Object pool hands objects across threads through the depot", "[pool]")
+{
+    Horus::ObjectPool<std::string> pool(64 * 1024, 4 * 1024);
+
+    /* A thread releasing more than its list holds spills the rest to the depot */
+    std::size_t kept = 0;
+    std::thread producer([&] {
+        for (int i = 0; i < 16; ++i)
+            kept += pool.give(std::unique_ptr<std::string>(new std::string()), 1024);
+    });
+    producer.join();
+
+    REQUIRE(kept == 16);
+
+    /* The producer exited, its own list went with it */
+    REQUIRE(pool.size() > 0);
+    REQUIRE(pool.size() < 16);
+    REQUIRE(pool.bytes() == pool.size() * 1024);
+
+    std::size_t taken = 0;
+    while (pool.take())
+        taken++;
+
+    REQUIRE(taken > 0);
+    REQUIRE(pool.size() == 0);
+    REQUIRE(pool.bytes() == 0);
+    REQUIRE(pool.stats().reused == taken);
+}
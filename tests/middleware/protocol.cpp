@@ -0,0 +1,210 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_message.hpp>
+
+#include "core/protocol.h"
+
+using Horus::Protocol::Encoding;
+
+TEST_CASE("Subprotocol names map to encodings", "[protocol]")
+{
+    Encoding encoding = Encoding::json;
+
+    REQUIRE(Horus::Protocol::encoding_from_subprotocol("horus.msgpack", encoding));
+    REQUIRE(encoding == Encoding::msgpack);
+
+    REQUIRE(Horus::Protocol::encoding_from_subprotocol("horus.cbor", encoding));
+    REQUIRE(encoding == Encoding::cbor);
+
+    /* Unknown and empty subprotocols leave the encoding untouched */
+    REQUIRE_FALSE(Horus::Protocol::encoding_from_subprotocol("", encoding));
+    REQUIRE_FALSE(Horus::Protocol::encoding_from_subprotocol("chat", encoding));
+    REQUIRE(encoding == Encoding::cbor);
+
+    REQUIRE(Horus::Protocol::encoding_from_string("json", encoding));
+    REQUIRE(encoding == Encoding::json);
+    REQUIRE_FALSE(Horus::Protocol::encoding_from_string("xml", encoding));
+}
+
+TEST_CASE("Payloads round trip through every encoding", "[protocol]")
+{
+    nlohmann::json payload({{"message_type", "update_agent"}, {"status", "ready"}, {"state", true}, {"name", "agent-42"}, {"guid", 42}});
+
+    for (Encoding encoding : {Encoding::json, Encoding::msgpack, Encoding::cbor})
+    {
+        std::string frame = Horus::Protocol::encode(payload, encoding);
+        nlohmann::json decoded = Horus::Protocol::parse(frame, encoding);
+
+        REQUIRE(decoded == payload);
+        REQUIRE(Horus::Protocol::message_type_of(decoded) == Horus::Protocol::MessageType::update_agent);
+
+        Horus::Protocol::UpdateMessage message;
+        REQUIRE(Horus::Protocol::decode(decoded, message));
+        REQUIRE(message.guid == 42);
+
+        /* Encoding into a reused buffer appends the same bytes without touching its capacity */
+        std::string buffer;
+        buffer.reserve(256);
+        const char *storage = buffer.data();
+
+        Horus::Protocol::encode_into(payload, encoding, buffer);
+        REQUIRE(buffer == frame);
+        REQUIRE(buffer.data() == storage);
+
+        WARN(Horus::Protocol::to_string(encoding) << " frame: " << frame.size() << " bytes");
+    }
+
+    /* Binary encodings are smaller than the JSON text */
+    REQUIRE(Horus::Protocol::encode(payload, Encoding::msgpack).size() < Horus::Protocol::encode(payload, Encoding::json).size());
+    REQUIRE(Horus::Protocol::encode(payload, Encoding::cbor).size() < Horus::Protocol::encode(payload, Encoding::json).size());
+}
+
+TEST_CASE("Garbage payloads parse as discarded", "[protocol]")
+{
+    for (Encoding encoding : {Encoding::json, Encoding::msgpack, Encoding::cbor})
+    {
+        nlohmann::json decoded = Horus::Protocol::parse(std::string("\xc1\xff{", 3), encoding);
+        REQUIRE(decoded.is_discarded());
+        REQUIRE(Horus::Protocol::message_type_of(decoded) == Horus::Protocol::MessageType::invalid);
+    }
+}
+
+TEST_CASE("Binary payloads with invalid UTF-8 parse as discarded", "[protocol]")
+{
+    REQUIRE(Horus::Protocol::valid_utf8("agent-42"));
+    REQUIRE(Horus::Protocol::valid_utf8("\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80"));
+    REQUIRE_FALSE(Horus::Protocol::valid_utf8("\xff"));
+    REQUIRE_FALSE(Horus::Protocol::valid_utf8("\xc0\xaf"));         /* overlong */
+    REQUIRE_FALSE(Horus::Protocol::valid_utf8("\xed\xa0\x80"));     /* surrogate */
+    REQUIRE_FALSE(Horus::Protocol::valid_utf8("\xe2\x82"));         /* truncated */
+    REQUIRE_FALSE(Horus::Protocol::valid_utf8("\xf4\x90\x80\x80")); /* above U+10FFFF */
+
+    nlohmann::json name({{"message_type", "update_agent_name"}, {"guid", 42}, {"name", "\xff"}});
+    nlohmann::json key({{"message_type", "update_agent_name"}, {"guid", 42}, {"name", "agent"}, {"\xfe", {"nested"}}});
+
+    for (Encoding encoding : {Encoding::msgpack, Encoding::cbor})
+    {
+        /* Binary writers take the bytes as they are, like a foreign peer would send them */
+        for (const nlohmann::json &payload : {name, key})
+        {
+            nlohmann::json decoded = Horus::Protocol::parse(Horus::Protocol::encode(payload, encoding), encoding);
+
+            REQUIRE(decoded.is_discarded());
+            REQUIRE(Horus::Protocol::message_type_of(decoded) == Horus::Protocol::MessageType::invalid);
+        }
+    }
+
+    /* Serializing never throws, invalid bytes become U+FFFD */
+    REQUIRE(Horus::Protocol::encode(name, Encoding::json) == "{\"guid\":42,\"message_type\":\"update_agent_name\",\"name\":\"\xef\xbf\xbd\"}");
+}
+
+TEST_CASE("Binary payloads nested past the depth limit parse as discarded", "[protocol]")
+{
+    /* One element arrays [MessagePack fixarray 0x91, CBOR 0x81] around a nil, a full frame worth of them */
+    const std::size_t frame = 1024 * 1024;
+
+    std::string msgpack(frame, '\x91');
+    msgpack.push_back('\xc0');
+
+    std::string cbor(frame, '\x81');
+    cbor.push_back('\xf6');
+
+    REQUIRE(Horus::Protocol::parse(msgpack, Encoding::msgpack).is_discarded());
+    REQUIRE(Horus::Protocol::parse(cbor, Encoding::cbor).is_discarded());
+
+    /* Up to the limit the value is kept */
+    std::string shallow(Horus::Protocol::max_depth, '\x91');
+    shallow.push_back('\xc0');
+
+    nlohmann::json decoded = Horus::Protocol::parse(shallow, Encoding::msgpack);
+    REQUIRE_FALSE(decoded.is_discarded());
+    REQUIRE(decoded.is_array());
+
+    std::string deep(Horus::Protocol::max_depth + 1, '\x91');
+    deep.push_back('\xc0');
+
+    REQUIRE(Horus::Protocol::parse(deep, Encoding::msgpack).is_discarded());
+}
+
+TEST_CASE("Batches carry complete messages", "[protocol]")
+{
+    nlohmann::json events = nlohmann::json::array();
+    events.push_back({{"message_type", "new_agent"}, {"status", "ready"}, {"state", false}, {"name", "a"}, {"guid", 1}});
+    events.push_back({{"message_type", "update_agent"}, {"status", "ready"}, {"state", true}, {"name", "a"}, {"guid", 1}});
+
+    nlohmann::json batch = Horus::Protocol::make_batch(events);
+    REQUIRE(Horus::Protocol::message_type_of(batch) == Horus::Protocol::MessageType::batch);
+
+    Horus::Protocol::BatchMessage message;
+    REQUIRE(Horus::Protocol::decode(batch, message));
+    REQUIRE(message.events.size() == 2);
+    REQUIRE(Horus::Protocol::message_type_of(message.events[1]) == Horus::Protocol::MessageType::update_agent);
+
+    /* events must be an array */
+    REQUIRE_FALSE(Horus::Protocol::decode(nlohmann::json({{"message_type", "batch"}, {"events", 1}}), message));
+    REQUIRE_FALSE(Horus::Protocol::decode(nlohmann::json({{"message_type", "batch"}}), message));
+}
+
+TEST_CASE("Snapshots carry agents as columns", "[protocol]")
+{
+    nlohmann::json agents = Horus::Protocol::make_snapshot_columns();
+
+    for (uint32_t guid : {3u, 7u})
+    {
+        agents["guid"].push_back(guid);
+        agents["name"].push_back("agent-" + std::to_string(guid));
+        agents["status"].push_back("ready");
+        agents["state"].push_back(guid == 7);
+        agents["version"].push_back(guid * 10);
+    }
+
+    nlohmann::json payload({{"message_type", "snapshot"}, {"version", 70}, {"since", 0}, {"agents", agents}});
+    REQUIRE(Horus::Protocol::message_type_of(payload) == Horus::Protocol::MessageType::snapshot);
+
+    Horus::Protocol::SnapshotMessage message;
+    REQUIRE(Horus::Protocol::decode(payload, message));
+    REQUIRE(message.version == 70);
+    REQUIRE(message.agents.size() == 2);
+    REQUIRE(message.agents[1].guid == 7);
+    REQUIRE(message.agents[1].name == "agent-7");
+    REQUIRE(message.agents[1].state);
+    REQUIRE(message.agents[1].version == 70);
+    REQUIRE(message.gone.empty());
+
+    payload["gone"] = {5, 6};
+    REQUIRE(Horus::Protocol::decode(payload, message));
+    REQUIRE(message.gone == std::vector<uint32_t>{5, 6});
+
+    Horus::Protocol::AgentGoneMessage gone;
+    nlohmann::json gone_payload({{"message_type", "agent_gone"}, {"guid", 5}, {"version", 71}});
+    REQUIRE(Horus::Protocol::message_type_of(gone_payload) == Horus::Protocol::MessageType::agent_gone);
+    REQUIRE(Horus::Protocol::decode(gone_payload, gone));
+    REQUIRE(gone.guid == 5);
+    REQUIRE(gone.version == 71);
+
+    /* Columns must line up */
+    payload["agents"]["name"].erase(0);
+    REQUIRE_FALSE(Horus::Protocol::decode(payload, message));
+
+    Horus::Protocol::SyncMessage sync;
+    REQUIRE(Horus::Protocol::decode(nlohmann::json({{"message_type", "sync"}, {"since", 5}}), sync));
+    REQUIRE(sync.since == 5);
+}
+
+TEST_CASE("Subscribe filters are optional", "[protocol]")
+{
+    Horus::Protocol::SubscribeMessage message;
+
+    REQUIRE(Horus::Protocol::decode(nlohmann::json({{"message_type", "subscribe"}}), message));
+    REQUIRE(message.everything());
+
+    REQUIRE(Horus::Protocol::decode(nlohmann::json::parse(R"({"message_type": "subscribe", "guids": [1, 2], "ranges": [[10, 20]], "prefixes": ["pump-"]})"), message));
+    REQUIRE(message.guids.size() == 2);
+    REQUIRE(message.ranges.at(0).first == 10);
+    REQUIRE(message.ranges.at(0).second == 20);
+    REQUIRE(message.prefixes.at(0) == "pump-");
+    REQUIRE_FALSE(message.everything());
+
+    /* Reversed ranges and mistyped fields are rejected */
+    REQUIRE_FALSE(Horus::Protocol::decode(nlohmann::json::parse(R"({"message_type": "subscribe", "ranges": [[20, 10]]})"), message));
+    REQUIRE_FALSE(Horus::Protocol::decode(nlohmann::json::parse(R"({"message_type": "subscribe", "guids": "all"})"), message));
+}
@@ -0,0 +1,99 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <thread>
+#include <vector>
+
+#include "core/registry.h"
+
+TEST_CASE("Sharded map basic operations", "[registry]")
+{
+    Horus::ShardedMap<uint32_t, int> map;
+
+    REQUIRE(map.insert(1, 10));
+    REQUIRE_FALSE(map.insert(1, 11));
+    REQUIRE(map.size() == 1);
+
+    int value = 0;
+    REQUIRE(map.find(1, value));
+    REQUIRE(value == 11);
+    REQUIRE_FALSE(map.find(2, value));
+
+    REQUIRE(map.update(1, [](int &v) { v++; }));
+    REQUIRE_FALSE(map.update(2, [](int &v) { v++; }));
+    REQUIRE_FALSE(map.contains(2));
+
+    REQUIRE(map.find(1, value));
+    REQUIRE(value == 12);
+
+    REQUIRE(map.erase(1));
+    REQUIRE_FALSE(map.erase(1));
+    REQUIRE(map.size() == 0);
+}
+
+TEST_CASE("Sharded map upsert and conditional erase", "[registry]")
+{
+    Horus::ShardedMap<uint32_t, std::vector<int>> map;
+
+    map.upsert(3, [](std::vector<int> &values) { values.push_back(1); });
+    map.upsert(3, [](std::vector<int> &values) { values.push_back(2); });
+
+    std::vector<int> values;
+    REQUIRE(map.find(3, values));
+    REQUIRE(values.size() == 2);
+
+    REQUIRE_FALSE(map.erase_if(3, [](const std::vector<int> &v) { return v.empty(); }));
+    REQUIRE(map.update(3, [](std::vector<int> &v) { v.clear(); }));
+    REQUIRE(map.erase_if(3, [](const std::vector<int> &v) { return v.empty(); }));
+    REQUIRE_FALSE(map.contains(3));
+}
+
+TEST_CASE("Sharded map concurrent writers", "[registry]")
+{
+    Horus::ShardedMap<uint32_t, uint32_t> map;
+
+    const uint32_t threads = 4;
+    const uint32_t per_thread = 10000;
+
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < threads; ++t)
+        workers.emplace_back([&, t]() {
+            for (uint32_t i = 0; i < per_thread; ++i)
+                map.insert(t * per_thread + i, i);
+        });
+
+    for (std::thread &worker : workers)
+        worker.join();
+
+    REQUIRE(map.size() == threads * per_thread);
+
+    uint64_t total = 0;
+    map.for_each([&](uint32_t, uint32_t value) { total += value; });
+    REQUIRE(total == uint64_t(threads) * (uint64_t(per_thread) * (per_thread - 1) / 2));
+}
+
+TEST_CASE("Dense index stays packed after removals", "[registry]")
+{
+    Horus::DenseIndex<uint32_t, int> index;
+
+    for (uint32_t i = 0; i < 8; ++i)
+        REQUIRE(index.insert(i, int(i) * 10));
+
+    REQUIRE(index.erase(0));
+    REQUIRE(index.erase(5));
+    REQUIRE_FALSE(index.erase(5));
+    REQUIRE(index.size() == 6);
+
+    int visited = 0;
+    index.for_each([&](uint32_t key, int value) {
+        REQUIRE(value == int(key) * 10);
+        REQUIRE(key != 0);
+        REQUIRE(key != 5);
+        visited++;
+    });
+    REQUIRE(visited == 6);
+
+    REQUIRE_FALSE(index.insert(7, 700));
+    REQUIRE(index.contains(7));
+    REQUIRE(index.erase(7));
+    REQUIRE(index.size() == 5);
+}
@@ -0,0 +1,75 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_message.hpp>
+
+#include <regex>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "core/router.h"
+
+TEST_CASE("Route table exact matching", "[router]")
+{
+    Horus::RouteTable<int> routes{{"/agents", 1}, {"/clients", 2}, {"/v2/agents", 3}};
+
+    REQUIRE(routes.size() == 3);
+
+    int value = 0;
+    REQUIRE(routes.match("/agents", value));
+    REQUIRE(value == 1);
+    REQUIRE(routes.match("/clients?token=abc", value));
+    REQUIRE(value == 2);
+    REQUIRE(routes.match("/v2/agents", value));
+    REQUIRE(value == 3);
+
+    /* Paths merely containing a route are rejected */
+    REQUIRE_FALSE(routes.match("/agentsx", value));
+    REQUIRE_FALSE(routes.match("/foo/clients", value));
+    REQUIRE_FALSE(routes.match("/v3/agents", value));
+    REQUIRE_FALSE(routes.match("/", value));
+    REQUIRE_FALSE(routes.match("", value));
+
+    routes.add("/agents", 4);
+    REQUIRE(routes.size() == 3);
+    REQUIRE(routes.match("/agents", value));
+    REQUIRE(value == 4);
+}
+
+TEST_CASE("Route table against per handshake regex", "[router][benchmark]")
+{
+    const std::size_t handshakes = 100000;
+    const std::vector<std::string> resources = {"/agents", "/clients", "/v1/agents", "/unknown"};
+
+    Horus::RouteTable<int> routes{{"/agents", 1}, {"/clients", 2}, {"/v1/agents", 1}, {"/v1/clients", 2}};
+
+    std::size_t matched = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    for (std::size_t i = 0; i < handshakes; ++i)
+    {
+        int value = 0;
+        matched += routes.match(resources[i % resources.size()], value);
+    }
+
+    auto table = std::chrono::steady_clock::now() - start;
+
+    std::size_t searched = 0;
+    start = std::chrono::steady_clock::now();
+
+    for (std::size_t i = 0; i < handshakes; ++i)
+    {
+        std::regex channel_regex("(/agents|/clients)", std::regex_constants::ECMAScript);
+        searched += std::regex_search(resources[i % resources.size()], channel_regex);
+    }
+
+    auto regex = std::chrono::steady_clock::now() - start;
+
+    double table_ns = std::chrono::duration<double, std::nano>(table).count() / handshakes;
+    double regex_ns = std::chrono::duration<double, std::nano>(regex).count() / handshakes;
+
+    WARN("ns per handshake lookup: route table " << table_ns << ", regex " << regex_ns);
+
+    REQUIRE(matched == handshakes / 4 * 3);
+    REQUIRE(searched == handshakes / 4 * 3);
+    REQUIRE(table < regex);
+}
@@ -0,0 +1,308 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/catch_message.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include <websocketpp/config/asio_no_tls_client.hpp>
+#include <websocketpp/client.hpp>
+
+#include "pch.hpp"
+#include "middleware.hpp"
+
+namespace
+{
+    typedef websocketpp::client<websocketpp::config::asio_client> ws_client_t;
+
+    /* Scripted peer [auth, ready, optionally subscribe, then close or go silent] */
+    struct Peer
+    {
+        std::string resource;
+        std::string name;
+
+        /* Never answers pings, left for the heartbeat to reap */
+        bool silent = false;
+
+        /* Client narrowed to the agents by prefix, lands in the filtered index */
+        bool subscribe = false;
+
+        std::atomic<bool> ready{false};
+        std::atomic<bool> closed{false};
+        con_hdl_t handle;
+    };
+
+    /* Resident set size in bytes, zero where /proc is unavailable */
+    std::size_t resident_bytes()
+    {
+#ifdef __linux__
+        std::ifstream statm("/proc/self/statm");
+
+        std::size_t pages = 0, resident = 0;
+        if (!(statm >> pages >> resident))
+            return 0;
+
+        return resident * static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+#else
+        return 0;
+#endif
+    }
+
+    bool wait_until(const std::function<bool()> &done, std::chrono::milliseconds timeout = std::chrono::seconds(10))
+    {
+        auto deadline = std::chrono::steady_clock::now() + timeout;
+
+        while (!done())
+        {
+            if (std::chrono::steady_clock::now() > deadline)
+                return false;
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        return true;
+    }
+
+    void send(ws_client_t &endpoint, const Peer &peer, const nlohmann::json &payload)
+    {
+        websocketpp::lib::error_code ec;
+        endpoint.send(peer.handle, payload.dump(), websocketpp::frame::opcode::text, ec);
+    }
+
+    void connect(ws_client_t &endpoint, uint16_t port, Peer &peer)
+    {
+        websocketpp::lib::error_code ec;
+        ws_client_t::connection_ptr con = endpoint.get_connection("ws://127.0.0.1:" + std::to_string(port) + peer.resource, ec);
+
+        if (ec)
+        {
+            peer.closed = true;
+            return;
+        }
+
+        peer.handle = con->get_handle();
+
+        con->set_open_handler([&endpoint, &peer](con_hdl_t) { send(endpoint, peer, nlohmann::json({{"message_type", "auth"}})); });
+        con->set_close_handler([&peer](con_hdl_t) { peer.closed = true; });
+        con->set_fail_handler([&peer](con_hdl_t) { peer.closed = true; });
+
+        /* A silent peer swallows pings instead of answering with a pong */
+        if (peer.silent)
+            con->set_ping_handler([](con_hdl_t, std::string) { return false; });
+
+        con->set_message_handler([&endpoint, &peer](con_hdl_t, ws_client_t::message_ptr message) {
+            nlohmann::json payload = nlohmann::json::parse(message->get_payload(), nullptr, false);
+
+            if (payload.is_discarded() || payload.value("message_type", "") != "ready")
+                return;
+
+            /* The auth reply hands out the guid, the second ready confirms it */
+            if (payload.value("status", "") == "open")
+            {
+                send(endpoint, peer, nlohmann::json({{"message_type", "ready"}, {"guid", payload["guid"]}, {"name", peer.name}, {"state", true}}));
+                return;
+            }
+
+            if (peer.subscribe)
+                send(endpoint, peer, nlohmann::json({{"message_type", "subscribe"}, {"guids", nlohmann::json::array()}, {"ranges", nlohmann::json::array()}, {"prefixes", {"agent-"}}}));
+
+            peer.ready = true;
+        });
+
+        endpoint.connect(con);
+    }
+
+    /* Peers connected and disconnected per round */
+    const uint32_t agents = 64;
+    const uint32_t clients = 16;
+
+    /* Rounds before the footprint is sampled, the metadata rows grow until the reuse queues fill */
+    const uint32_t warmup = 30;
+
+    /* Every tenth round leaves its agents silent so the heartbeat reaps them */
+    const uint32_t silent_every = 10;
+
+    /* Outcome of a soak run, checked by check_soak */
+    struct Soak
+    {
+        uint64_t cycles = 0;
+        uint32_t rounds = 0;
+        uint32_t stuck_rounds = 0;
+        uint32_t leaked_rounds = 0;
+        uint64_t ready_agents = 0;
+        uint64_t silent_agents = 0;
+        registry_stats_t warm;
+        registry_stats_t stats;
+        heartbeat_stats_t heartbeat;
+        std::size_t baseline = 0;
+        std::size_t final = 0;
+    };
+
+    /* Run a middleware on loopback [on a port the system picks] through at least cycles connect and disconnect cycles */
+    Soak run_soak(uint64_t cycles)
+    {
+        Soak soak;
+        soak.rounds = static_cast<uint32_t>(std::max<uint64_t>((cycles + agents + clients - 1) / (agents + clients), warmup + 1));
+        soak.cycles = static_cast<uint64_t>(soak.rounds) * (agents + clients);
+
+        Middleware middleware;
+        middleware.set_heartbeat(std::chrono::milliseconds(50), std::chrono::milliseconds(250));
+        middleware.run(0, 2);
+
+        ws_client_t endpoint;
+        endpoint.clear_access_channels(websocketpp::log::alevel::all);
+        endpoint.clear_error_channels(websocketpp::log::elevel::all);
+        endpoint.init_asio();
+        endpoint.start_perpetual();
+
+        std::thread runner([&endpoint]() { endpoint.run(); });
+
+        for (uint32_t round = 0; round < soak.rounds; ++round)
+        {
+            bool silent = round % silent_every == silent_every - 1;
+
+            std::vector<std::unique_ptr<Peer>> peers;
+
+            /* Distinct names every round, the name table has to let go of the old ones */
+            for (uint32_t i = 0; i < agents; ++i)
+            {
+                peers.emplace_back(new Peer());
+                peers.back()->resource = "/agents";
+                peers.back()->name = "agent-" + std::to_string(round) + "-" + std::to_string(i);
+                peers.back()->silent = silent;
+            }
+
+            for (uint32_t i = 0; i < clients; ++i)
+            {
+                peers.emplace_back(new Peer());
+                peers.back()->resource = "/clients";
+                peers.back()->name = "client-" + std::to_string(round) + "-" + std::to_string(i);
+                peers.back()->subscribe = i % 2 == 0;
+            }
+
+            for (std::unique_ptr<Peer> &peer : peers)
+                connect(endpoint, middleware.port(), *peer);
+
+            bool all_ready = wait_until([&]() {
+                for (const std::unique_ptr<Peer> &peer : peers)
+                    if (!peer->ready && !peer->closed)
+                        return false;
+                return true;
+            });
+
+            soak.stuck_rounds += !all_ready;
+            soak.ready_agents += agents;
+            soak.silent_agents += silent ? agents : 0;
+
+            /* Clients always hang up, agents too unless they were left to time out */
+            for (std::unique_ptr<Peer> &peer : peers)
+            {
+                if (peer->silent)
+                    continue;
+
+                websocketpp::lib::error_code ec;
+                endpoint.close(peer->handle, websocketpp::close::status::normal, "soak", ec);
+            }
+
+            bool all_closed = wait_until([&]() {
+                for (const std::unique_ptr<Peer> &peer : peers)
+                    if (!peer->closed)
+                        return false;
+                return true;
+            });
+
+            soak.stuck_rounds += !all_closed;
+
+            /* Nothing outlives its connection but the capped tombstones [reaping finishes on the middleware workers] */
+            registry_stats_t stats;
+            bool drained = wait_until(
+                [&]() {
+                    stats = middleware.registry_stats();
+                    return stats.sessions == 0 && stats.metadata == 0 && stats.names == 0 && stats.ready_clients == 0 && stats.firehose_clients == 0 && stats.filtered_clients == 0 && stats.agent_subscribers == 0 && stats.pending_updates == 0;
+                },
+                std::chrono::seconds(2));
+
+            soak.leaked_rounds += !drained;
+
+            if (round == warmup - 1)
+            {
+                soak.warm = stats;
+                soak.baseline = resident_bytes();
+            }
+        }
+
+        soak.stats = middleware.registry_stats();
+        soak.heartbeat = middleware.heartbeat_stats();
+        soak.final = resident_bytes();
+
+        middleware.stop();
+        endpoint.stop_perpetual();
+        runner.join();
+
+        return soak;
+    }
+
+    /* Pass criterion: the registry drained after every round and its footprint never grew past the warmup round [resident memory is checked on top where /proc can be read] */
+    void check_soak(const Soak &soak)
+    {
+        REQUIRE(soak.stuck_rounds == 0);
+        REQUIRE(soak.leaked_rounds == 0);
+
+        REQUIRE(soak.stats.sessions == 0);
+        REQUIRE(soak.stats.metadata == 0);
+        REQUIRE(soak.stats.names == 0);
+        REQUIRE(soak.stats.ready_clients == 0);
+        REQUIRE(soak.stats.firehose_clients == 0);
+        REQUIRE(soak.stats.filtered_clients == 0);
+        REQUIRE(soak.stats.agent_subscribers == 0);
+        REQUIRE(soak.stats.pending_updates == 0);
+
+        /* Every ready agent left a tombstone, the oldest ones were dropped */
+        REQUIRE(soak.ready_agents > 4096);
+        REQUIRE(soak.stats.tombstones == 4096);
+        REQUIRE(soak.heartbeat.agents_gone == soak.ready_agents);
+
+        /* The silent agents were closed by the heartbeat, not by their peers */
+        REQUIRE(soak.heartbeat.timeouts >= soak.silent_agents);
+
+        /* Freed rows and names are reused, the tables never outgrow the peak of live connections */
+        REQUIRE(soak.stats.metadata_bytes <= soak.warm.metadata_bytes);
+        REQUIRE(soak.stats.names_bytes <= soak.warm.names_bytes);
+
+        if (soak.baseline == 0 || soak.final == 0)
+        {
+            WARN("resident set size unavailable, only the registry footprint was checked");
+            return;
+        }
+
+        WARN("resident bytes after " << warmup << " rounds " << soak.baseline << ", after " << soak.rounds << " rounds [" << soak.cycles << " cycles] " << soak.final);
+        REQUIRE(soak.final <= soak.baseline + 4 * 1024 * 1024);
+    }
+} // namespace
+
+/* Smoke run for every ctest, about ten thousand cycles */
+TEST_CASE("Connect and disconnect cycles leave memory flat", "[soak]")
+{
+    check_soak(run_soak(120 * (agents + clients)));
+}
+
+/* Hidden from the default run, start it with middleware_tests [soak] [a million cycles unless HORUS_SOAK_CYCLES says otherwise] */
+TEST_CASE("A million connect and disconnect cycles leave memory flat", "[.soak]")
+{
+    uint64_t cycles = 1000000;
+
+    if (const char *requested = std::getenv("HORUS_SOAK_CYCLES"))
+        cycles = std::strtoull(requested, nullptr, 10);
+
+    check_soak(run_soak(cycles));
+}
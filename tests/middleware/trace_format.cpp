@@ -0,0 +1,224 @@
+#include <catch2/catch_test_macros.hpp>
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <cstdint>
+
+#include "debug/trace_format.h"
+
+namespace
+{
+    struct Decoded
+    {
+        std::vector<std::string> names;
+        std::vector<Horus::Debug::Trace::Event> events;
+        std::vector<Horus::Debug::Trace::Flow> flows;
+        uint64_t dropped = 0;
+        bool valid = false;
+    };
+
+    Decoded decode(const std::string &bytes)
+    {
+        Decoded decoded;
+        std::istringstream in(bytes);
+
+        decoded.valid = Horus::Debug::Trace::decode(
+            in,
+            [&](uint32_t id, const std::string &name) {
+                if (id >= decoded.names.size())
+                    decoded.names.resize(id + 1);
+                decoded.names[id] = name;
+            },
+            [&](const Horus::Debug::Trace::Event &event) { decoded.events.push_back(event); },
+            [&](const Horus::Debug::Trace::Flow &flow) { decoded.flows.push_back(flow); },
+            [&](uint64_t count) { decoded.dropped += count; });
+
+        return decoded;
+    }
+} // namespace
+
+TEST_CASE("Trace format picks JSON by extension", "[trace]")
+{
+    REQUIRE(Horus::Debug::Trace::format_of("profile_results.json") == Horus::Debug::Trace::Format::json);
+    REQUIRE(Horus::Debug::Trace::format_of("profile_results.trace") == Horus::Debug::Trace::Format::binary);
+    REQUIRE(Horus::Debug::Trace::format_of("json") == Horus::Debug::Trace::Format::binary);
+}
+
+TEST_CASE("Trace records round trip", "[trace]")
+{
+    Horus::Debug::Trace::Encoder encoder;
+    std::ostringstream out;
+
+    const int64_t base = 1792197363226791000;
+
+    encoder.header();
+    encoder.name(0, "void Middleware::on_message()");
+    encoder.name(1, "void Middleware::fan_out()");
+
+    /* Inner scopes end first, so starts of a thread go backwards as often as forwards */
+    encoder.event(0, 1, base + 500, base + 900);
+    encoder.event(0, 0, base, base + 1000);
+    encoder.event(3, 0, base + 20, base + 20);
+    encoder.event(0, 1, base + 2000, base + 2100);
+    encoder.dropped(7);
+    encoder.flush(out);
+
+    std::size_t bytes = out.str().size();
+    Decoded decoded = decode(out.str());
+
+    REQUIRE(decoded.valid);
+    REQUIRE(decoded.names.size() == 2);
+    REQUIRE(decoded.names[1] == "void Middleware::fan_out()");
+    REQUIRE(decoded.dropped == 7);
+    REQUIRE(decoded.events.size() == 4);
+
+    REQUIRE(decoded.events[0].thread == 0);
+    REQUIRE(decoded.events[0].name == 1);
+    REQUIRE(decoded.events[0].start_ns == base + 500);
+    REQUIRE(decoded.events[0].dur_ns == 400);
+    REQUIRE(decoded.events[1].start_ns == base);
+    REQUIRE(decoded.events[1].dur_ns == 1000);
+    REQUIRE(decoded.events[2].thread == 3);
+    REQUIRE(decoded.events[2].start_ns == base + 20);
+    REQUIRE(decoded.events[2].dur_ns == 0);
+    REQUIRE(decoded.events[3].start_ns == base + 2000);
+
+    /* Only the first event of a thread pays for the absolute timestamp */
+    Horus::Debug::Trace::Encoder steady;
+    std::ostringstream steady_out;
+
+    for (int64_t i = 0; i < 1000; ++i)
+        steady.event(0, 0, base + i * 1000, base + i * 1000 + 250);
+
+    steady.flush(steady_out);
+
+    REQUIRE(steady_out.str().size() < 1000 * 8);
+    REQUIRE(bytes < 128);
+}
+
+TEST_CASE("Trace flows round trip between events of the same thread", "[trace]")
+{
+    const int64_t base = 1700000000000000000;
+    const uint64_t id = (uint64_t(0x1fffff) << 32) | 42;
+
+    Horus::Debug::Trace::Encoder encoder;
+    std::ostringstream out;
+
+    encoder.header();
+    encoder.name(0, "update_agent");
+    encoder.name(1, "void Middleware::fan_out()");
+    encoder.flow(2, 0, Horus::Debug::Trace::FlowPhase::step, base + 300, id);
+    encoder.event(2, 1, base, base + 900);
+    encoder.flow(2, 0, Horus::Debug::Trace::FlowPhase::end, base + 800, id + 1);
+    encoder.flush(out);
+
+    Decoded decoded = decode(out.str());
+
+    REQUIRE(decoded.valid);
+    REQUIRE(decoded.events.size() == 1);
+    REQUIRE(decoded.events[0].start_ns == base);
+    REQUIRE(decoded.flows.size() == 2);
+
+    REQUIRE(decoded.flows[0].thread == 2);
+    REQUIRE(decoded.flows[0].name == 0);
+    REQUIRE(decoded.flows[0].phase == Horus::Debug::Trace::FlowPhase::step);
+    REQUIRE(decoded.flows[0].ts_ns == base + 300);
+    REQUIRE(decoded.flows[0].id == id);
+    REQUIRE(decoded.flows[1].phase == Horus::Debug::Trace::FlowPhase::end);
+    REQUIRE(decoded.flows[1].ts_ns == base + 800);
+    REQUIRE(decoded.flows[1].id == id + 1);
+
+    /* Version 1 traces predate flows, carrying one makes them malformed, so does an unknown phase */
+    std::string bytes = out.str();
+    std::string version_1 = bytes;
+    version_1[4] = 1;
+
+    REQUIRE_FALSE(decode(version_1).valid);
+
+    std::string bad_phase = bytes;
+    bad_phase[bytes.find(static_cast<char>(Horus::Debug::Trace::Record::flow)) + 3] = 7;
+
+    REQUIRE_FALSE(decode(bad_phase).valid);
+}
+
+TEST_CASE("Trace decoder rejects foreign and truncated input", "[trace]")
+{
+    REQUIRE_FALSE(decode("").valid);
+    REQUIRE_FALSE(decode("{\"otherData\": {}").valid);
+
+    Horus::Debug::Trace::Encoder encoder;
+    std::ostringstream out;
+
+    encoder.header();
+    encoder.name(0, "scope");
+    encoder.event(0, 0, 1000000, 2000000);
+    encoder.flush(out);
+
+    std::string bytes = out.str();
+
+    REQUIRE(decode(bytes).valid);
+    REQUIRE_FALSE(decode(bytes.substr(0, bytes.size() - 1)).valid);
+}
+
+TEST_CASE("Trace decoder rejects ids and lengths past the bounds", "[trace]")
+{
+    using namespace Horus::Debug::Trace;
+
+    std::string header(magic, sizeof(magic));
+    header.push_back(static_cast<char>(version));
+
+    auto record = [&](Record kind, const std::vector<uint64_t> &fields) {
+        std::string bytes = header;
+        bytes.push_back(static_cast<char>(kind));
+        for (uint64_t field : fields)
+            put_varint(bytes, field);
+        return bytes;
+    };
+
+    /* Thread ids that would overflow or blow up the per thread table */
+    REQUIRE_FALSE(decode(record(Record::event, {~0ull, 0, 0, 0})).valid);
+    REQUIRE_FALSE(decode(record(Record::event, {max_threads, 0, 0, 0})).valid);
+    REQUIRE(decode(record(Record::event, {max_threads - 1, 0, 0, 0})).valid);
+
+    std::string flow = header;
+    flow.push_back(static_cast<char>(Record::flow));
+    put_varint(flow, ~0ull);
+    put_varint(flow, 0);
+    flow.push_back(static_cast<char>(FlowPhase::start));
+    put_varint(flow, 0);
+    put_varint(flow, 1);
+    REQUIRE_FALSE(decode(flow).valid);
+
+    /* Name ids and lengths that would size huge allocations */
+    REQUIRE_FALSE(decode(record(Record::event, {0, max_names, 0, 0})).valid);
+    REQUIRE_FALSE(decode(record(Record::name, {max_names, 0})).valid);
+    REQUIRE_FALSE(decode(record(Record::name, {0, ~0ull})).valid);
+    REQUIRE_FALSE(decode(record(Record::name, {0, max_name_length + 1})).valid);
+
+    /* A length within the bounds but past the end of the file */
+    REQUIRE_FALSE(decode(record(Record::name, {0, max_name_length})).valid);
+}
+
+TEST_CASE("Trace decoder rejects flows in version 1 files", "[trace]")
+{
+    using namespace Horus::Debug::Trace;
+
+    std::string flow;
+    flow.push_back(static_cast<char>(Record::flow));
+    put_varint(flow, 0);
+    put_varint(flow, 0);
+    flow.push_back(static_cast<char>(FlowPhase::start));
+    put_varint(flow, 0);
+    put_varint(flow, 1);
+
+    std::string v1(magic, sizeof(magic));
+    v1.push_back(1);
+
+    std::string v2(magic, sizeof(magic));
+    v2.push_back(2);
+
+    REQUIRE(decode(v1).valid);
+    REQUIRE_FALSE(decode(v1 + flow).valid);
+    REQUIRE(decode(v2 + flow).valid);
+}
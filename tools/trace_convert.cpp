@@ -0,0 +1,100 @@
+/**
+ * @file trace_convert.cpp
+ * @brief Binary Trace to Chrome Trace JSON Converter
+ *
+ */
+
+/* Args parser */
+#include <clipp.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+
+#include "debug/trace_format.h"
+
+/* Application Entry Point */
+int main(int argc, char **argv)
+{
+    /* Args variables */
+    std::string input_path;
+    std::string output_path;
+
+    /* Set cli options */
+    clipp::group cli(
+        clipp::value("input", input_path).doc("binary trace written by a profiling build"),
+        clipp::opt_value("output", output_path).doc("chrome trace json [default: input with a .json extension]"));
+
+    /* Parse the args */
+    if (!clipp::parse(argc, argv, cli))
+    {
+        /* Show help */
+        std::cout << clipp::make_man_page(cli, "trace_convert");
+        return 1;
+    }
+
+    if (output_path.empty())
+        output_path = input_path.substr(0, input_path.rfind('.')) + ".json";
+
+    std::ifstream input(input_path, std::ios::in | std::ios::binary);
+
+    if (!input)
+    {
+        std::cerr << "!> cannot open " << input_path << std::endl;
+        return 1;
+    }
+
+    std::ofstream output(output_path);
+
+    if (!output)
+    {
+        std::cerr << "!> cannot create " << output_path << std::endl;
+        return 1;
+    }
+
+    std::vector<std::string> names;
+    uint64_t events = 0;
+    uint64_t dropped = 0;
+
+    Horus::Debug::Trace::write_json_header(output);
+
+    bool valid = Horus::Debug::Trace::decode(
+        input,
+        [&](uint32_t id, const std::string &name) {
+            if (id >= names.size())
+                names.resize(id + 1);
+
+            names[id] = name;
+        },
+        [&](const Horus::Debug::Trace::Event &event) {
+            if (events++ > 0)
+                output << ",";
+
+            long long start = event.start_ns / 1000;
+            long long end = (event.start_ns + event.dur_ns) / 1000;
+            const std::string unknown = "unknown";
+
+            Horus::Debug::Trace::write_json_event(output, event.name < names.size() ? names[event.name] : unknown, event.thread, start, end - start);
+        },
+        [&](const Horus::Debug::Trace::Flow &flow) {
+            if (events++ > 0)
+                output << ",";
+
+            const std::string unknown = "unknown";
+
+            Horus::Debug::Trace::write_json_flow(output, flow.name < names.size() ? names[flow.name] : unknown, flow.phase, flow.id, 0, flow.thread, flow.ts_ns / 1000);
+        },
+        [&](uint64_t count) { dropped += count; });
+
+    Horus::Debug::Trace::write_json_footer(output, dropped);
+
+    if (!valid)
+    {
+        std::cerr << "!> " << input_path << " is truncated or not a trace, converted " << events << " events" << std::endl;
+        return 1;
+    }
+
+    std::cout << "converted " << events << " events [" << dropped << " dropped] into " << output_path << std::endl;
+    return 0;
+}
@@ -0,0 +1,186 @@
+/**
+ * @file trace_merge.cpp
+ * @brief Merges the Binary Traces of Several Processes into one Chrome Trace
+ *
+ */
+
+/* Args parser */
+#include <clipp.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+
+#include "debug/trace_format.h"
+
+namespace
+{
+    /* Decoded trace of one process */
+    struct Process
+    {
+        std::string label;
+        std::vector<std::string> names;
+        std::vector<Horus::Debug::Trace::Event> events;
+        std::vector<Horus::Debug::Trace::Flow> flows;
+        uint64_t dropped = 0;
+
+        /* Added to every timestamp [ns] */
+        int64_t offset = 0;
+    };
+
+    bool load(const std::string &path, Process &process)
+    {
+        std::ifstream input(path, std::ios::in | std::ios::binary);
+
+        if (!input)
+            return false;
+
+        std::size_t slash = path.find_last_of("/\\");
+        process.label = path.substr(slash == std::string::npos ? 0 : slash + 1);
+        process.label = process.label.substr(0, process.label.rfind('.'));
+
+        return Horus::Debug::Trace::decode(
+            input,
+            [&](uint32_t id, const std::string &name) {
+                if (id >= process.names.size())
+                    process.names.resize(id + 1);
+
+                process.names[id] = name;
+            },
+            [&](const Horus::Debug::Trace::Event &event) { process.events.push_back(event); },
+            [&](const Horus::Debug::Trace::Flow &flow) { process.flows.push_back(flow); },
+            [&](uint64_t count) { process.dropped += count; });
+    }
+
+    const std::string &name_of(const Process &process, uint32_t id)
+    {
+        static const std::string unknown = "unknown";
+        return id < process.names.size() ? process.names[id] : unknown;
+    }
+
+    /*
+     * Clocks of different processes, or hosts, disagree. Every process is
+     * shifted forward just enough that none of its hops happens before a
+     * hop of the same flow recorded by an earlier process, so the inputs
+     * must come in hop order [agent, middleware, client]. The result is a
+     * lower bound of the skew, never an overcorrection.
+     */
+    void align(std::vector<Process> &processes)
+    {
+        /* Latest aligned hop of every flow seen so far [ns] */
+        std::unordered_map<uint64_t, int64_t> latest;
+
+        for (Process &process : processes)
+        {
+            int64_t shift = 0;
+
+            for (const Horus::Debug::Trace::Flow &flow : process.flows)
+            {
+                auto it = latest.find(flow.id);
+
+                if (it != latest.end())
+                    shift = std::max(shift, it->second - flow.ts_ns);
+            }
+
+            process.offset = shift;
+
+            for (const Horus::Debug::Trace::Flow &flow : process.flows)
+            {
+                int64_t &ts = latest[flow.id];
+                ts = std::max(ts, flow.ts_ns + shift);
+            }
+        }
+    }
+} // namespace
+
+/* Application Entry Point */
+int main(int argc, char **argv)
+{
+    /* Args variables */
+    std::string output_path = "merged_trace.json";
+    std::vector<std::string> input_paths;
+    bool no_align = false;
+
+    /* Set cli options */
+    clipp::group cli(
+        clipp::option("-o", "--output").doc("merged chrome trace json [default: merged_trace.json]") & clipp::value("file", output_path),
+        clipp::option("--no-align").set(no_align).doc("keep the timestamps of every trace as recorded"),
+        clipp::values("traces", input_paths).doc("binary traces in hop order [agent middleware client]"));
+
+    /* Parse the args */
+    if (!clipp::parse(argc, argv, cli) || input_paths.empty())
+    {
+        /* Show help */
+        std::cout << clipp::make_man_page(cli, "trace_merge");
+        return 1;
+    }
+
+    std::vector<Process> processes(input_paths.size());
+
+    for (std::size_t i = 0; i < input_paths.size(); ++i)
+    {
+        if (!load(input_paths[i], processes[i]))
+        {
+            std::cerr << "!> " << input_paths[i] << " is missing, truncated or not a trace" << std::endl;
+            return 1;
+        }
+    }
+
+    if (!no_align)
+        align(processes);
+
+    std::ofstream output(output_path);
+
+    if (!output)
+    {
+        std::cerr << "!> cannot create " << output_path << std::endl;
+        return 1;
+    }
+
+    uint64_t dropped = 0;
+    bool first = true;
+
+    auto separate = [&]() {
+        if (!first)
+            output << ",";
+        first = false;
+    };
+
+    Horus::Debug::Trace::write_json_header(output);
+
+    for (std::size_t i = 0; i < processes.size(); ++i)
+    {
+        const Process &process = processes[i];
+        uint32_t pid = static_cast<uint32_t>(i + 1);
+
+        separate();
+        Horus::Debug::Trace::write_json_process_name(output, pid, process.label);
+
+        for (const Horus::Debug::Trace::Event &event : process.events)
+        {
+            long long start = (event.start_ns + process.offset) / 1000;
+            long long end = (event.start_ns + event.dur_ns + process.offset) / 1000;
+
+            separate();
+            Horus::Debug::Trace::write_json_event(output, name_of(process, event.name), event.thread, start, end - start, pid);
+        }
+
+        for (const Horus::Debug::Trace::Flow &flow : process.flows)
+        {
+            separate();
+            Horus::Debug::Trace::write_json_flow(output, name_of(process, flow.name), flow.phase, flow.id, pid, flow.thread, (flow.ts_ns + process.offset) / 1000);
+        }
+
+        dropped += process.dropped;
+
+        std::cout << process.label << " => events [" << process.events.size() << "] flows [" << process.flows.size() << "] offset [" << process.offset / 1000 << " us]" << std::endl;
+    }
+
+    Horus::Debug::Trace::write_json_footer(output, dropped);
+
+    std::cout << "merged " << processes.size() << " traces into " << output_path << std::endl;
+    return 0;
+}